@@ -2,6 +2,8 @@
 #define _AAString_H_
 
 #include <string.h>
+#include <ctype.h>
+#include "hash.h"
 
 #define AAS_MAXLEN 256
 
@@ -20,6 +22,17 @@ struct AAString
 		return(strcmp(tmpName ? tmpName : Name, str.tmpName ? str.tmpName : str.Name) < 0);
 	}
 
+	//! сравнение со строкой без создания временного AAString
+	__forceinline bool operator==(const char * str) const
+	{
+		return(strcmp(tmpName ? tmpName : Name, str) == 0);
+	}
+
+	__forceinline bool operator<(const char * str) const
+	{
+		return(strcmp(tmpName ? tmpName : Name, str) < 0);
+	}
+
 	__forceinline void setName(const char * str)const
 	{
 		strcpy(Name, str);
@@ -71,6 +84,64 @@ struct AAStringNR: public AAString
 #endif
 			(tmpName ? tmpName : Name, str.tmpName ? str.tmpName : str.Name) == 0);
 	}
+
+	__forceinline bool operator==(const char * str) const
+	{
+		return(
+#ifdef _MSC_VER
+			_stricmp
+#else 
+			strcasecmp
+#endif
+			(tmpName ? tmpName : Name, str) == 0);
+	}
+};
+
+//! хеш для HashMap, считается по содержимому строки
+template<>
+struct XHash<AAString>
+{
+	size_t operator()(const AAString &str) const
+	{
+		const char *szName = str.getName();
+		return((size_t)XHashBytes(szName, strlen(szName)));
+	}
+};
+
+//! регистронезависимый хеш, согласован с AAStringNR::operator==
+template<>
+struct XHash<AAStringNR>
+{
+	size_t operator()(const AAStringNR &str) const
+	{
+		uint64_t ullHash = 0;
+		for(const char *szName = str.getName(); *szName; ++szName)
+		{
+			ullHash = XHashCombine(ullHash, (uint64_t)tolower((unsigned char)*szName));
+		}
+		return((size_t)XHashMix(ullHash));
+	}
+};
+
+//! поиск в AssotiativeArray по const char* без создания временного AAString
+template<>
+struct XIsTransparentKey<AAString, const char*>: std::true_type
+{
+};
+
+template<>
+struct XIsTransparentKey<AAString, char*>: std::true_type
+{
+};
+
+template<>
+struct XIsTransparentKey<AAStringNR, const char*>: std::true_type
+{
+};
+
+template<>
+struct XIsTransparentKey<AAStringNR, char*>: std::true_type
+{
 };
 
 #endif
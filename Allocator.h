@@ -0,0 +1,48 @@
+/******************************************************
+Copyright © Vitaliy Buturlin, Evgeny Danilovich, 2017
+See the license in LICENSE
+******************************************************/
+
+#ifndef __COMMON_ALLOCATOR_H
+#define __COMMON_ALLOCATOR_H
+
+#include "types.h"
+
+constexpr size_t MemAllocNextPow2(size_t uSize, size_t uPow = 1)
+{
+	return(uPow >= uSize ? uPow : MemAllocNextPow2(uSize, uPow * 2));
+}
+
+constexpr size_t MemAllocAlignUp(size_t uSize, size_t uAlign)
+{
+	return((uSize + uAlign - 1) / uAlign * uAlign);
+}
+
+/*! Стратегия выделения памяти для контейнеров.
+	Стратегия - класс без состояния со статическими методами:
+		static void* Alloc(size_t uSize, size_t uAlign);
+		static void Free(void *pMem, size_t uSize);
+		static bool Resize(void *pMem, size_t uOldSize, size_t uNewSize); // изменение размера на месте, false - если невозможно
+	В Free передается тот же размер, что был запрошен в Alloc
+*/
+
+//! выделение памяти из системной кучи, используется по умолчанию
+struct HeapAllocator
+{
+	static void* Alloc(size_t uSize, size_t uAlign)
+	{
+		return(_aligned_malloc(uSize, uAlign));
+	}
+
+	static void Free(void *pMem, size_t)
+	{
+		_aligned_free(pMem);
+	}
+
+	static bool Resize(void*, size_t, size_t)
+	{
+		return(false);
+	}
+};
+
+#endif
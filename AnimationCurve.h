@@ -74,11 +74,11 @@ inline float XMETHODCALLTYPE CAnimationCurve::evaluate(float fTime) const
 	fTime = wrapTime(fTime);
 	UINT uLength = m_aKeyFrames.size();
 
-	int idx = m_aKeyFrames.indexOf(fTime, [](const XKeyframe &kf, float fTime){
-		return(kf.fTime >= fTime);
+	UINT idx = m_aKeyFrames.lowerBound(fTime, [](const XKeyframe &kf, float fTime){
+		return(kf.fTime < fTime);
 	});
 
-	if(idx < 0)
+	if(idx == uLength)
 	{
 		idx = uLength - 1;
 	}
@@ -102,8 +102,8 @@ inline UINT XMETHODCALLTYPE CAnimationCurve::addKey(float fTime, float fValue)
 	newKF.fTime = fTime;
 	newKF.fValue = fValue;
 
-	return(m_aKeyFrames.insert(newKF, [](const XKeyframe &a, const XKeyframe &b){
-		return(a.fTime > b.fTime);
+	return(m_aKeyFrames.insertSorted(newKF, [](const XKeyframe &a, const XKeyframe &b){
+		return(a.fTime < b.fTime);
 	}));
 }
 
@@ -0,0 +1,137 @@
+/******************************************************
+Copyright © Vitaliy Buturlin, Evgeny Danilovich, 2017
+See the license in LICENSE
+******************************************************/
+
+#ifndef __ARRAY_PARALLEL_H
+#define __ARRAY_PARALLEL_H
+
+/*
+	Многопоточные алгоритмы над Array и MemAlloc.
+	Вынесены из array.h и MemAlloc.h, чтобы эти заголовки не тянули за собой <thread>
+*/
+
+#include <thread>
+#include <common/MemAlloc.h>
+
+//! массивы короче этого ArrayParallelSort сортирует в одном потоке
+#define ARRAY_PARALLEL_SORT_THRESHOLD 65536
+
+//! вызывает fn(i) для i из [0, uCount), каждый вызов в своем потоке
+template <typename L>
+void ArrayRunParallel(UINT uCount, const L &fn)
+{
+	Array<std::thread> aThreads;
+	aThreads.reserve(uCount - 1);
+	for(UINT i = 1; i < uCount; ++i)
+	{
+		aThreads.push_back(std::thread(fn, i));
+	}
+	fn(0);
+	for(UINT i = 0; i < aThreads.size(); ++i)
+	{
+		aThreads[i].join();
+	}
+}
+
+/*! Нестабильная сортировка массива arr в uThreads потоках: части массива сортируются параллельно
+	и попарно сливаются. Массивы короче ARRAY_PARALLEL_SORT_THRESHOLD сортируются quickSort
+	@note CompareFunc вызывается из нескольких потоков
+*/
+template <typename A, typename L>
+void ArrayParallelSort(A &arr, const L &CompareFunc, UINT uThreads)
+{
+	typedef typename std::remove_reference<decltype(arr[0u])>::type T;
+
+	if(arr.size() < ARRAY_PARALLEL_SORT_THRESHOLD || uThreads < 2)
+	{
+		arr.quickSort(CompareFunc);
+		return;
+	}
+
+	UINT uChunks = 1;
+	while(uChunks * 2 <= uThreads)
+	{
+		uChunks *= 2;
+	}
+
+	Array<UINT> aBounds;
+	for(UINT i = 0; i <= uChunks; ++i)
+	{
+		aBounds.push_back((UINT)((uint64_t)arr.size() * i / uChunks));
+	}
+
+	ArrayRunParallel(uChunks, [&](UINT i){
+		arr.introSortInternal(CompareFunc, aBounds[i], aBounds[i + 1], A::GetSortDepthLimit(aBounds[i + 1] - aBounds[i]));
+	});
+
+	for(UINT uStep = 1; uStep < uChunks; uStep *= 2)
+	{
+		ArrayRunParallel(uChunks / (uStep * 2), [&](UINT i){
+			UINT lo = aBounds[uStep * 2 * i];
+			UINT mid = aBounds[uStep * (2 * i + 1)];
+			// буфер из кучи, т.к. текущая арена потока в рабочих потоках не задана
+			T *pBuffer = (T*)HeapAllocator::Alloc(sizeof(T) * (mid - lo), alignof(T));
+			arr.mergeInternal(CompareFunc, lo, mid, aBounds[uStep * 2 * (i + 1)], pBuffer);
+			HeapAllocator::Free(pBuffer, sizeof(T) * (mid - lo));
+		});
+	}
+}
+
+template <typename A, typename L>
+void ArrayParallelSort(A &arr, const L &CompareFunc)
+{
+	ArrayParallelSort(arr, CompareFunc, std::thread::hardware_concurrency());
+}
+
+template <typename A>
+void ArrayParallelSort(A &arr)
+{
+	typedef typename std::remove_reference<decltype(arr[0u])>::type T;
+	ArrayParallelSort(arr, [](const T &a, const T &b){
+		return(a < b);
+	});
+}
+
+/*! параллельный MemAlloc::forEach: блоки пула pool распределяются между uThreads потоками, включая вызывающий
+	@note fn должна быть потокобезопасной, изменять пул во время обхода нельзя
+*/
+template<typename P, typename L>
+void MemAllocForEachParallel(P &pool, const L &fn, UINT uThreads)
+{
+	uThreads = min(uThreads, (UINT)pool.NumFilledBlocks);
+	if(uThreads < 2)
+	{
+		pool.forEach(fn);
+		return;
+	}
+
+	std::atomic<int> iNextBlock(0);
+	auto worker = [&pool, &fn, &iNextBlock](){
+		int iBlock;
+		while((iBlock = iNextBlock.fetch_add(1, std::memory_order_relaxed)) < pool.NumFilledBlocks)
+		{
+			pool.ForEachInBlock(iBlock, fn);
+		}
+	};
+
+	Array<std::thread> aThreads;
+	aThreads.reserve(uThreads - 1);
+	for(UINT i = 0; i < uThreads - 1; ++i)
+	{
+		aThreads.push_back(std::thread(worker));
+	}
+	worker();
+	for(UINT i = 0; i < aThreads.size(); ++i)
+	{
+		aThreads[i].join();
+	}
+}
+
+template<typename P, typename L>
+void MemAllocForEachParallel(P &pool, const L &fn)
+{
+	MemAllocForEachParallel(pool, fn, std::thread::hardware_concurrency());
+}
+
+#endif
@@ -0,0 +1,694 @@
+/******************************************************
+Copyright © Vitaliy Buturlin, Evgeny Danilovich, 2017
+See the license in LICENSE
+******************************************************/
+
+#ifndef __COMMON_BTREE_MAP_H
+#define __COMMON_BTREE_MAP_H
+
+#include <common/MemAlloc.h>
+
+//! размер узла BTreeMap по умолчанию, по нему вычисляется количество ключей в узле
+#define BTREE_MAP_NODE_BYTES 256
+//! предельная высота дерева, при минимальном ветвлении 2 хватает на 2^32 элементов
+#define BTREE_MAP_MAX_HEIGHT 32
+
+/*! Упорядоченный ассоциативный массив на основе B+-дерева с интерфейсом AssotiativeArray.
+	Ключи узла хранятся непрерывно, значения лежат в листьях рядом с ключами, листья связаны в список,
+	поэтому поиск делает один-два промаха кэша на уровень вместо одного на каждый узел красно-черного дерева,
+	а обход по порядку идет по соседним элементам.
+	lowerBound/upperBound возвращают итератор для обхода диапазона:
+		for(auto i = map.lowerBound(from); i && *i.first < to; ++i)
+	В отличие от AssotiativeArray значения перемещаются при вставке и удалении,
+	поэтому указатели на значения (и итераторы) действительны только до следующего изменения массива,
+	insert и KeyExists возвращают указатель на значение, а не Node.
+	@note K должен иметь operator< и operator==
+*/
+template<typename K, typename V, UINT NodeBytes = BTREE_MAP_NODE_BYTES, typename Allocator = HeapAllocator>
+class BTreeMap
+{
+	static const UINT LEAF_SIZE = (NodeBytes - 2 * sizeof(void*)) / (sizeof(K) + sizeof(V)) > 4 ? (NodeBytes - 2 * sizeof(void*)) / (sizeof(K) + sizeof(V)) : 4;
+	static const UINT INNER_SIZE = (NodeBytes - 2 * sizeof(void*)) / (sizeof(K) + sizeof(void*)) > 4 ? (NodeBytes - 2 * sizeof(void*)) / (sizeof(K) + sizeof(void*)) : 4;
+	static const UINT LEAF_MIN = LEAF_SIZE / 2;
+	static const UINT INNER_MIN = INNER_SIZE / 2;
+
+	struct Leaf
+	{
+		Leaf *pNext;
+		UINT uCount;
+		alignas(K) byte keys[sizeof(K) * LEAF_SIZE];
+		alignas(V) byte vals[sizeof(V) * LEAF_SIZE];
+
+		K* getKeys()
+		{
+			return((K*)keys);
+		}
+
+		V* getVals()
+		{
+			return((V*)vals);
+		}
+	};
+
+	//! ключ i разделяет потомков i и i + 1, все ключи потомка i + 1 не меньше его
+	struct Inner
+	{
+		UINT uCount;
+		void *apChildren[INNER_SIZE + 1];
+		alignas(K) byte keys[sizeof(K) * INNER_SIZE];
+
+		K* getKeys()
+		{
+			return((K*)keys);
+		}
+	};
+
+	//! путь от корня к листу
+	struct Path
+	{
+		Inner *apNodes[BTREE_MAP_MAX_HEIGHT];
+		UINT auIndex[BTREE_MAP_MAX_HEIGHT];
+	};
+
+public:
+	class Iterator
+	{
+	public:
+		const K *first;
+		V *second;
+
+		Iterator(Leaf *pLeaf = NULL, UINT uIndex = 0):
+			m_pLeaf(pLeaf),
+			m_uIndex(uIndex)
+		{
+			Seek();
+		}
+
+		bool operator==(const Iterator &c) const
+		{
+			return(c.m_pLeaf == m_pLeaf && c.m_uIndex == m_uIndex);
+		}
+
+		bool operator!=(const Iterator &c) const
+		{
+			return(!(*this == c));
+		}
+
+		operator bool() const
+		{
+			return(m_pLeaf != NULL);
+		}
+
+		Iterator& operator++()
+		{
+			++m_uIndex;
+			Seek();
+			return(*this);
+		}
+
+		Iterator operator++(int)
+		{
+			Iterator it = *this;
+			++(*this);
+			return(it);
+		}
+
+	private:
+		void Seek()
+		{
+			while(m_pLeaf && m_uIndex >= m_pLeaf->uCount)
+			{
+				m_pLeaf = m_pLeaf->pNext;
+				m_uIndex = 0;
+			}
+
+			if(m_pLeaf)
+			{
+				first = &m_pLeaf->getKeys()[m_uIndex];
+				second = &m_pLeaf->getVals()[m_uIndex];
+			}
+			else
+			{
+				m_uIndex = 0;
+				first = NULL;
+				second = NULL;
+			}
+		}
+
+		Leaf *m_pLeaf;
+		UINT m_uIndex;
+	};
+
+	BTreeMap() = default;
+
+	BTreeMap(const BTreeMap &other)
+	{
+		*this = other;
+	}
+
+	~BTreeMap()
+	{
+		clear();
+	}
+
+	BTreeMap& operator=(const BTreeMap &other)
+	{
+		if(&other != this)
+		{
+			clear();
+			for(Iterator i = other.begin(); i; ++i)
+			{
+				insert(*i.first, *i.second);
+			}
+		}
+		return(*this);
+	}
+
+	bool KeyExists(const K &key, V **ppVal = NULL) const
+	{
+		V *pVal = Find(key);
+		if(ppVal)
+		{
+			*ppVal = pVal;
+		}
+		return(pVal != NULL);
+	}
+
+	//! при create == true отсутствующий ключ добавляется, возвращается true, только если ключ уже был
+	bool KeyExists(const K &key, V **ppVal = NULL, bool create = false)
+	{
+		bool found = !create;
+		V *pVal = create ? Insert(key, &found) : Find(key);
+		if(ppVal)
+		{
+			*ppVal = pVal;
+		}
+		return(pVal != NULL && found);
+	}
+
+	//! добавляет ключ со значением, сконструированным из args, существующее значение не изменяется
+	template<typename... Args>
+	V* insert(const K &key, Args&&... args)
+	{
+		return(Insert(key, NULL, args...));
+	}
+
+	V& operator[](const K &key)
+	{
+		return(*Insert(key, NULL));
+	}
+
+	const V& operator[](const K &key) const
+	{
+		V *pVal = Find(key);
+		assert(pVal);
+		return(*pVal);
+	}
+
+	const V* at(const K &key) const
+	{
+		return(Find(key));
+	}
+
+	unsigned int Size() const
+	{
+		return(m_uSize);
+	}
+
+	void erase(const K &key)
+	{
+		if(!m_pRoot)
+		{
+			return;
+		}
+
+		Path path;
+		Leaf *pLeaf = Descend(key, &path);
+		UINT uPos = LowerBound(pLeaf->getKeys(), pLeaf->uCount, key);
+		if(uPos == pLeaf->uCount || !(pLeaf->getKeys()[uPos] == key))
+		{
+			return;
+		}
+
+		pLeaf->getKeys()[uPos].~K();
+		pLeaf->getVals()[uPos].~V();
+		Relocate(pLeaf->getKeys() + uPos, pLeaf->getKeys() + uPos + 1, pLeaf->uCount - uPos - 1);
+		Relocate(pLeaf->getVals() + uPos, pLeaf->getVals() + uPos + 1, pLeaf->uCount - uPos - 1);
+		--pLeaf->uCount;
+		--m_uSize;
+
+		if(m_uHeight == 1)
+		{
+			if(!pLeaf->uCount)
+			{
+				m_memLeaves.Delete(pLeaf);
+				m_pRoot = NULL;
+				m_pFirstLeaf = NULL;
+				m_uHeight = 0;
+			}
+			return;
+		}
+
+		if(pLeaf->uCount >= LEAF_MIN)
+		{
+			return;
+		}
+
+		UINT uLevel = m_uHeight - 2;
+		RebalanceLeaf(pLeaf, path.apNodes[uLevel], path.auIndex[uLevel]);
+		for(; uLevel > 0 && path.apNodes[uLevel]->uCount < INNER_MIN; --uLevel)
+		{
+			RebalanceInner(path.apNodes[uLevel], path.apNodes[uLevel - 1], path.auIndex[uLevel - 1]);
+		}
+
+		Inner *pRoot = (Inner*)m_pRoot;
+		if(!pRoot->uCount)
+		{
+			m_pRoot = pRoot->apChildren[0];
+			m_memInners.Delete(pRoot);
+			--m_uHeight;
+		}
+	}
+
+	void clear()
+	{
+		if(m_pRoot)
+		{
+			DestroyNode(m_pRoot, 1);
+		}
+		m_pRoot = NULL;
+		m_pFirstLeaf = NULL;
+		m_uHeight = 0;
+		m_uSize = 0;
+		m_memLeaves.clear();
+		m_memInners.clear();
+	}
+
+	Iterator begin() const
+	{
+		return(Iterator(m_pFirstLeaf, 0));
+	}
+
+	Iterator end() const
+	{
+		return(Iterator());
+	}
+
+	//! итератор на первый элемент с ключом не меньше key
+	Iterator lowerBound(const K &key) const
+	{
+		if(!m_pRoot)
+		{
+			return(end());
+		}
+		Leaf *pLeaf = Descend(key, NULL);
+		return(Iterator(pLeaf, LowerBound(pLeaf->getKeys(), pLeaf->uCount, key)));
+	}
+
+	//! итератор на первый элемент с ключом больше key
+	Iterator upperBound(const K &key) const
+	{
+		if(!m_pRoot)
+		{
+			return(end());
+		}
+		Leaf *pLeaf = Descend(key, NULL);
+		return(Iterator(pLeaf, UpperBound(pLeaf->getKeys(), pLeaf->uCount, key)));
+	}
+
+private:
+	//! количество ключей, меньших key, поиск без ветвлений (см. Array::lowerBound)
+	static UINT LowerBound(const K *pKeys, UINT uCount, const K &key)
+	{
+		if(!uCount)
+		{
+			return(0);
+		}
+		const K *pBase = pKeys;
+		while(uCount > 1)
+		{
+			UINT uHalf = uCount / 2;
+			pBase = pBase[uHalf] < key ? pBase + uHalf : pBase;
+			uCount -= uHalf;
+		}
+		return((UINT)(pBase - pKeys) + (*pBase < key ? 1 : 0));
+	}
+
+	//! количество ключей, не больших key
+	static UINT UpperBound(const K *pKeys, UINT uCount, const K &key)
+	{
+		if(!uCount)
+		{
+			return(0);
+		}
+		const K *pBase = pKeys;
+		while(uCount > 1)
+		{
+			UINT uHalf = uCount / 2;
+			pBase = !(key < pBase[uHalf]) ? pBase + uHalf : pBase;
+			uCount -= uHalf;
+		}
+		return((UINT)(pBase - pKeys) + (!(key < *pBase) ? 1 : 0));
+	}
+
+	//! перемещение uCount элементов в неинициализированную память, диапазоны могут перекрываться
+	template<typename T>
+	static void Relocate(T *pDst, T *pSrc, UINT uCount)
+	{
+		Relocate(pDst, pSrc, uCount, ArrayIsRelocatable<T>());
+	}
+
+	template<typename T>
+	static void Relocate(T *pDst, T *pSrc, UINT uCount, std::true_type)
+	{
+		if(uCount)
+		{
+			memmove((void*)pDst, pSrc, sizeof(T) * uCount);
+		}
+	}
+
+	template<typename T>
+	static void Relocate(T *pDst, T *pSrc, UINT uCount, std::false_type)
+	{
+		if(pDst < pSrc)
+		{
+			for(UINT i = 0; i < uCount; ++i)
+			{
+				new(&pDst[i]) T(std::move(pSrc[i]));
+				pSrc[i].~T();
+			}
+		}
+		else
+		{
+			for(UINT i = uCount; i > 0; --i)
+			{
+				new(&pDst[i - 1]) T(std::move(pSrc[i - 1]));
+				pSrc[i - 1].~T();
+			}
+		}
+	}
+
+	//! спуск к листу, который может содержать key, с запоминанием пути
+	Leaf* Descend(const K &key, Path *pPath) const
+	{
+		void *pNode = m_pRoot;
+		for(UINT i = 0; i + 1 < m_uHeight; ++i)
+		{
+			Inner *pInner = (Inner*)pNode;
+			UINT uIndex = UpperBound(pInner->getKeys(), pInner->uCount, key);
+			if(pPath)
+			{
+				pPath->apNodes[i] = pInner;
+				pPath->auIndex[i] = uIndex;
+			}
+			pNode = pInner->apChildren[uIndex];
+		}
+		return((Leaf*)pNode);
+	}
+
+	V* Find(const K &key) const
+	{
+		if(!m_pRoot)
+		{
+			return(NULL);
+		}
+		Leaf *pLeaf = Descend(key, NULL);
+		UINT uPos = LowerBound(pLeaf->getKeys(), pLeaf->uCount, key);
+		if(uPos < pLeaf->uCount && pLeaf->getKeys()[uPos] == key)
+		{
+			return(&pLeaf->getVals()[uPos]);
+		}
+		return(NULL);
+	}
+
+	template<typename... Args>
+	V* Insert(const K &key, bool *found, Args&&... args)
+	{
+		if(!m_pRoot)
+		{
+			Leaf *pLeaf = m_memLeaves.Alloc();
+			pLeaf->pNext = NULL;
+			pLeaf->uCount = 0;
+			m_pRoot = m_pFirstLeaf = pLeaf;
+			m_uHeight = 1;
+		}
+
+		Path path;
+		Leaf *pLeaf = Descend(key, &path);
+		UINT uPos = LowerBound(pLeaf->getKeys(), pLeaf->uCount, key);
+		if(uPos < pLeaf->uCount && pLeaf->getKeys()[uPos] == key)
+		{
+			if(found)
+			{
+				*found = true;
+			}
+			return(&pLeaf->getVals()[uPos]);
+		}
+
+		++m_uSize;
+		if(pLeaf->uCount < LEAF_SIZE)
+		{
+			return(InsertIntoLeaf(pLeaf, uPos, key, args...));
+		}
+
+		// лист полон: верхняя половина переносится в новый лист, первый ключ которого поднимается в родителя
+		Leaf *pRight = m_memLeaves.Alloc();
+		UINT uMid = (LEAF_SIZE + 1) / 2;
+		Relocate(pRight->getKeys(), pLeaf->getKeys() + uMid, LEAF_SIZE - uMid);
+		Relocate(pRight->getVals(), pLeaf->getVals() + uMid, LEAF_SIZE - uMid);
+		pRight->uCount = LEAF_SIZE - uMid;
+		pLeaf->uCount = uMid;
+		pRight->pNext = pLeaf->pNext;
+		pLeaf->pNext = pRight;
+
+		V *pVal = uPos < uMid ? InsertIntoLeaf(pLeaf, uPos, key, args...) : InsertIntoLeaf(pRight, uPos - uMid, key, args...);
+		InsertIntoParent(&path, m_uHeight - 1, pRight->getKeys()[0], pRight);
+		return(pVal);
+	}
+
+	template<typename... Args>
+	V* InsertIntoLeaf(Leaf *pLeaf, UINT uPos, const K &key, Args&&... args)
+	{
+		Relocate(pLeaf->getKeys() + uPos + 1, pLeaf->getKeys() + uPos, pLeaf->uCount - uPos);
+		Relocate(pLeaf->getVals() + uPos + 1, pLeaf->getVals() + uPos, pLeaf->uCount - uPos);
+		new(&pLeaf->getKeys()[uPos]) K(key);
+		V *pVal = new(&pLeaf->getVals()[uPos]) V(args...);
+		++pLeaf->uCount;
+		return(pVal);
+	}
+
+	//! вставляет ключ key и правого от него потомка pChild в узел с индексом uPos
+	void InsertIntoInner(Inner *pNode, UINT uPos, const K &key, void *pChild)
+	{
+		Relocate(pNode->getKeys() + uPos + 1, pNode->getKeys() + uPos, pNode->uCount - uPos);
+		new(&pNode->getKeys()[uPos]) K(key);
+		memmove(pNode->apChildren + uPos + 2, pNode->apChildren + uPos + 1, sizeof(void*) * (pNode->uCount - uPos));
+		pNode->apChildren[uPos + 1] = pChild;
+		++pNode->uCount;
+	}
+
+	/*! добавляет в родителя узла уровня uLevel разделитель key и новый правый узел pChild,
+		при переполнении родитель делится, и разделение поднимается выше
+	*/
+	void InsertIntoParent(Path *pPath, UINT uLevel, K key, void *pChild)
+	{
+		for(;;)
+		{
+			if(!uLevel)
+			{
+				Inner *pRoot = m_memInners.Alloc();
+				new(&pRoot->getKeys()[0]) K(std::move(key));
+				pRoot->apChildren[0] = m_pRoot;
+				pRoot->apChildren[1] = pChild;
+				pRoot->uCount = 1;
+				m_pRoot = pRoot;
+				++m_uHeight;
+				assert(m_uHeight <= BTREE_MAP_MAX_HEIGHT);
+				return;
+			}
+
+			Inner *pParent = pPath->apNodes[uLevel - 1];
+			UINT uPos = pPath->auIndex[uLevel - 1];
+			if(pParent->uCount < INNER_SIZE)
+			{
+				InsertIntoInner(pParent, uPos, key, pChild);
+				return;
+			}
+
+			// средний ключ уходит наверх, правее него - в новый узел
+			Inner *pRight = m_memInners.Alloc();
+			UINT uMid = INNER_SIZE / 2;
+			K upKey(std::move(pParent->getKeys()[uMid]));
+			pParent->getKeys()[uMid].~K();
+			Relocate(pRight->getKeys(), pParent->getKeys() + uMid + 1, INNER_SIZE - uMid - 1);
+			memcpy(pRight->apChildren, pParent->apChildren + uMid + 1, sizeof(void*) * (INNER_SIZE - uMid));
+			pRight->uCount = INNER_SIZE - uMid - 1;
+			pParent->uCount = uMid;
+
+			if(uPos <= uMid)
+			{
+				InsertIntoInner(pParent, uPos, key, pChild);
+			}
+			else
+			{
+				InsertIntoInner(pRight, uPos - uMid - 1, key, pChild);
+			}
+
+			key = std::move(upKey);
+			pChild = pRight;
+			--uLevel;
+		}
+	}
+
+	//! удаляет из узла ключ uPos и потомка справа от него
+	void RemoveFromInner(Inner *pNode, UINT uPos)
+	{
+		pNode->getKeys()[uPos].~K();
+		Relocate(pNode->getKeys() + uPos, pNode->getKeys() + uPos + 1, pNode->uCount - uPos - 1);
+		memmove(pNode->apChildren + uPos + 1, pNode->apChildren + uPos + 2, sizeof(void*) * (pNode->uCount - uPos - 1));
+		--pNode->uCount;
+	}
+
+	//! пополняет лист с недостатком элементов за счет соседа или сливает его с соседом
+	void RebalanceLeaf(Leaf *pLeaf, Inner *pParent, UINT uIndex)
+	{
+		Leaf *pLeft = uIndex > 0 ? (Leaf*)pParent->apChildren[uIndex - 1] : NULL;
+		Leaf *pRight = uIndex < pParent->uCount ? (Leaf*)pParent->apChildren[uIndex + 1] : NULL;
+
+		if(pLeft && pLeft->uCount > LEAF_MIN)
+		{
+			Relocate(pLeaf->getKeys() + 1, pLeaf->getKeys(), pLeaf->uCount);
+			Relocate(pLeaf->getVals() + 1, pLeaf->getVals(), pLeaf->uCount);
+			--pLeft->uCount;
+			Relocate(pLeaf->getKeys(), pLeft->getKeys() + pLeft->uCount, 1);
+			Relocate(pLeaf->getVals(), pLeft->getVals() + pLeft->uCount, 1);
+			++pLeaf->uCount;
+			pParent->getKeys()[uIndex - 1] = pLeaf->getKeys()[0];
+			return;
+		}
+
+		if(pRight && pRight->uCount > LEAF_MIN)
+		{
+			Relocate(pLeaf->getKeys() + pLeaf->uCount, pRight->getKeys(), 1);
+			Relocate(pLeaf->getVals() + pLeaf->uCount, pRight->getVals(), 1);
+			++pLeaf->uCount;
+			--pRight->uCount;
+			Relocate(pRight->getKeys(), pRight->getKeys() + 1, pRight->uCount);
+			Relocate(pRight->getVals(), pRight->getVals() + 1, pRight->uCount);
+			pParent->getKeys()[uIndex] = pRight->getKeys()[0];
+			return;
+		}
+
+		if(pLeft)
+		{
+			MergeLeaves(pLeft, pLeaf);
+			RemoveFromInner(pParent, uIndex - 1);
+		}
+		else
+		{
+			MergeLeaves(pLeaf, pRight);
+			RemoveFromInner(pParent, uIndex);
+		}
+	}
+
+	//! переносит все элементы pRight в конец pLeft и удаляет pRight
+	void MergeLeaves(Leaf *pLeft, Leaf *pRight)
+	{
+		Relocate(pLeft->getKeys() + pLeft->uCount, pRight->getKeys(), pRight->uCount);
+		Relocate(pLeft->getVals() + pLeft->uCount, pRight->getVals(), pRight->uCount);
+		pLeft->uCount += pRight->uCount;
+		pLeft->pNext = pRight->pNext;
+		m_memLeaves.Delete(pRight);
+	}
+
+	//! то же для внутреннего узла, при переносе потомков через родителя проворачивается разделитель
+	void RebalanceInner(Inner *pNode, Inner *pParent, UINT uIndex)
+	{
+		Inner *pLeft = uIndex > 0 ? (Inner*)pParent->apChildren[uIndex - 1] : NULL;
+		Inner *pRight = uIndex < pParent->uCount ? (Inner*)pParent->apChildren[uIndex + 1] : NULL;
+
+		if(pLeft && pLeft->uCount > INNER_MIN)
+		{
+			Relocate(pNode->getKeys() + 1, pNode->getKeys(), pNode->uCount);
+			new(&pNode->getKeys()[0]) K(std::move(pParent->getKeys()[uIndex - 1]));
+			memmove(pNode->apChildren + 1, pNode->apChildren, sizeof(void*) * (pNode->uCount + 1));
+			pNode->apChildren[0] = pLeft->apChildren[pLeft->uCount];
+			++pNode->uCount;
+
+			--pLeft->uCount;
+			pParent->getKeys()[uIndex - 1] = std::move(pLeft->getKeys()[pLeft->uCount]);
+			pLeft->getKeys()[pLeft->uCount].~K();
+			return;
+		}
+
+		if(pRight && pRight->uCount > INNER_MIN)
+		{
+			new(&pNode->getKeys()[pNode->uCount]) K(std::move(pParent->getKeys()[uIndex]));
+			pNode->apChildren[pNode->uCount + 1] = pRight->apChildren[0];
+			++pNode->uCount;
+
+			pParent->getKeys()[uIndex] = std::move(pRight->getKeys()[0]);
+			pRight->getKeys()[0].~K();
+			--pRight->uCount;
+			Relocate(pRight->getKeys(), pRight->getKeys() + 1, pRight->uCount);
+			memmove(pRight->apChildren, pRight->apChildren + 1, sizeof(void*) * (pRight->uCount + 1));
+			return;
+		}
+
+		if(pLeft)
+		{
+			MergeInners(pLeft, pNode, pParent->getKeys()[uIndex - 1]);
+			RemoveFromInner(pParent, uIndex - 1);
+		}
+		else
+		{
+			MergeInners(pNode, pRight, pParent->getKeys()[uIndex]);
+			RemoveFromInner(pParent, uIndex);
+		}
+	}
+
+	void MergeInners(Inner *pLeft, Inner *pRight, const K &separator)
+	{
+		new(&pLeft->getKeys()[pLeft->uCount]) K(separator);
+		Relocate(pLeft->getKeys() + pLeft->uCount + 1, pRight->getKeys(), pRight->uCount);
+		memcpy(pLeft->apChildren + pLeft->uCount + 1, pRight->apChildren, sizeof(void*) * (pRight->uCount + 1));
+		pLeft->uCount += pRight->uCount + 1;
+		m_memInners.Delete(pRight);
+	}
+
+	//! разрушает ключи и значения поддерева, память узлов освобождается вместе с пулами
+	void DestroyNode(void *pNode, UINT uLevel)
+	{
+		if(uLevel == m_uHeight)
+		{
+			Leaf *pLeaf = (Leaf*)pNode;
+			for(UINT i = 0; i < pLeaf->uCount; ++i)
+			{
+				pLeaf->getKeys()[i].~K();
+				pLeaf->getVals()[i].~V();
+			}
+			return;
+		}
+
+		Inner *pInner = (Inner*)pNode;
+		for(UINT i = 0; i < pInner->uCount; ++i)
+		{
+			pInner->getKeys()[i].~K();
+		}
+		for(UINT i = 0; i <= pInner->uCount; ++i)
+		{
+			DestroyNode(pInner->apChildren[i], uLevel + 1);
+		}
+	}
+
+	void *m_pRoot = NULL;
+	Leaf *m_pFirstLeaf = NULL;
+	//! количество уровней, листья - уровень m_uHeight
+	UINT m_uHeight = 0;
+	UINT m_uSize = 0;
+
+	MemAlloc<Leaf, 64, 16, alignof(Leaf), MemAllocHeaderLayout, Allocator> m_memLeaves;
+	MemAlloc<Inner, 16, 16, alignof(Inner), MemAllocHeaderLayout, Allocator> m_memInners;
+};
+
+#endif
@@ -66,11 +66,11 @@ inline float4_t XMETHODCALLTYPE CColorGradient::evaluate(float fTime) const
 	else
 	{
 		UINT uLength = m_aColorKeys.size();
-		int idx = m_aColorKeys.indexOf(fTime, [](const XColorKey &kf, float fTime){
-			return(kf.fTime >= fTime);
+		UINT idx = m_aColorKeys.lowerBound(fTime, [](const XColorKey &kf, float fTime){
+			return(kf.fTime < fTime);
 		});
 
-		if(idx < 0)
+		if(idx == uLength)
 		{
 			vResult = float4(m_aColorKeys[uLength - 1].vColor, 1.0f);
 		}
@@ -100,11 +100,11 @@ inline float4_t XMETHODCALLTYPE CColorGradient::evaluate(float fTime) const
 	{
 		UINT uLength = m_aAlphaKeys.size();
 
-		int idx = m_aAlphaKeys.indexOf(fTime, [](const XAlphaKey &kf, float fTime){
-			return(kf.fTime >= fTime);
+		UINT idx = m_aAlphaKeys.lowerBound(fTime, [](const XAlphaKey &kf, float fTime){
+			return(kf.fTime < fTime);
 		});
 
-		if(idx < 0)
+		if(idx == uLength)
 		{
 			vResult.w = m_aAlphaKeys[uLength - 1].fAlpha;
 		}
@@ -135,8 +135,8 @@ inline UINT XMETHODCALLTYPE CColorGradient::addColorKey(float fTime, const float
 	newKey.fTime = fTime;
 	newKey.vColor = vValue;
 
-	return(m_aColorKeys.insert(newKey, [](const XColorKey &a, const XColorKey &b){
-		return(a.fTime > b.fTime);
+	return(m_aColorKeys.insertSorted(newKey, [](const XColorKey &a, const XColorKey &b){
+		return(a.fTime < b.fTime);
 	}));
 }
 inline UINT XMETHODCALLTYPE CColorGradient::addAlphaKey(float fTime, float fValue)
@@ -149,8 +149,8 @@ inline UINT XMETHODCALLTYPE CColorGradient::addAlphaKey(float fTime, float fValu
 	newKey.fTime = fTime;
 	newKey.fAlpha = fValue;
 
-	return(m_aAlphaKeys.insert(newKey, [](const XAlphaKey &a, const XAlphaKey &b){
-		return(a.fTime > b.fTime);
+	return(m_aAlphaKeys.insertSorted(newKey, [](const XAlphaKey &a, const XAlphaKey &b){
+		return(a.fTime < b.fTime);
 	}));
 }
 
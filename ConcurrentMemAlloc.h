@@ -0,0 +1,260 @@
+/******************************************************
+Copyright © Vitaliy Buturlin, Evgeny Danilovich, 2017
+See the license in LICENSE
+******************************************************/
+
+#ifndef __CONCURRENT_MEMALLOC_H
+#define __CONCURRENT_MEMALLOC_H
+
+#include <common/MemAlloc.h>
+#include <common/types.h>
+
+/*! Номер потока для ConcurrentMemAlloc.
+	Номера уникальны среди живущих потоков и переиспользуются после их завершения,
+	поэтому остаются маленькими и подходят для индексации массива слотов
+*/
+class MemAllocThreadSlot
+{
+public:
+	static UINT Get()
+	{
+		static thread_local MemAllocThreadSlot s_slot;
+		return(s_slot.m_uSlot);
+	}
+
+private:
+	struct Registry
+	{
+		SpinLock lock;
+		UINT uNextSlot = 0;
+		UINT *pFreeSlots = NULL;
+		UINT uFreeSlots = 0;
+		UINT uFreeSlotsAlloc = 0;
+	};
+
+	static Registry& GetRegistry()
+	{
+		static Registry s_registry;
+		return(s_registry);
+	}
+
+	MemAllocThreadSlot()
+	{
+		Registry &reg = GetRegistry();
+		ScopedSpinLock lock(reg.lock);
+		if(reg.uFreeSlots)
+		{
+			m_uSlot = reg.pFreeSlots[--reg.uFreeSlots];
+		}
+		else
+		{
+			m_uSlot = reg.uNextSlot++;
+		}
+	}
+
+	~MemAllocThreadSlot()
+	{
+		Registry &reg = GetRegistry();
+		ScopedSpinLock lock(reg.lock);
+		if(reg.uFreeSlots == reg.uFreeSlotsAlloc)
+		{
+			reg.uFreeSlotsAlloc += 16;
+			reg.pFreeSlots = (UINT*)realloc(reg.pFreeSlots, sizeof(UINT) * reg.uFreeSlotsAlloc);
+		}
+		reg.pFreeSlots[reg.uFreeSlots++] = m_uSlot;
+	}
+
+	UINT m_uSlot;
+};
+
+/*! Потокобезопасный пул объектов поверх MemAlloc.
+	Каждый поток держит небольшой магазин свободных ячеек и обращается к общему
+	пулу под блокировкой только пачками по MagazineSize / 2 ячеек.
+	Потоки с номером MaxThreads и выше работают с общим пулом напрямую.
+	@note ячейки, освобожденные другим потоком, попадают в магазин освободившего потока
+*/
+template <typename T, int SizeBlock = 256, int SizePage = 16, const int alignBy = alignof(T), int MagazineSize = 32, int MaxThreads = 64, typename Layout = MemAllocHeaderLayout>
+class ConcurrentMemAlloc
+{
+	static_assert(MagazineSize >= 2, "MagazineSize should be at least 2");
+
+public:
+	ConcurrentMemAlloc() = default;
+
+	ConcurrentMemAlloc(const ConcurrentMemAlloc&) = delete;
+
+	ConcurrentMemAlloc& operator=(const ConcurrentMemAlloc&) = delete;
+
+	~ConcurrentMemAlloc()
+	{
+		for(int i = 0; i < MaxThreads; ++i)
+		{
+			Magazine &mag = m_aMagazines[i];
+			UINT uCount = mag.uCount.load(std::memory_order_relaxed);
+			for(UINT j = 0; j < uCount; ++j)
+			{
+				m_depot.DeleteRaw(mag.apCells[j]);
+			}
+			mag.uCount.store(0, std::memory_order_relaxed);
+		}
+	}
+
+	template<typename... Args>
+	T* Alloc(Args&&... args)
+	{
+		T *pCell = AllocRaw();
+		return(new (pCell)T(args...));
+	}
+
+	void Delete(T *pointer)
+	{
+		pointer->~T();
+		DeleteRaw(pointer);
+	}
+
+	void Delete(void *ptr)
+	{
+		Delete((T*)ptr);
+	}
+
+	//! выделяет ячейку без вызова конструктора
+	T* AllocRaw()
+	{
+		MEMALLOC_STAT(m_stats.onAllocShared());
+
+		UINT uSlot = MemAllocThreadSlot::Get();
+		if(uSlot >= MaxThreads)
+		{
+			ScopedSpinLock lock(m_lock);
+			return(m_depot.AllocRaw());
+		}
+
+		Magazine &mag = m_aMagazines[uSlot];
+		UINT uCount = mag.uCount.load(std::memory_order_relaxed);
+		if(!uCount)
+		{
+			ScopedSpinLock lock(m_lock);
+			for(; uCount < MagazineSize / 2; ++uCount)
+			{
+				mag.apCells[uCount] = m_depot.AllocRaw();
+			}
+		}
+		--uCount;
+		mag.uCount.store(uCount, std::memory_order_relaxed);
+		return(mag.apCells[uCount]);
+	}
+
+	//! освобождает ячейку без вызова деструктора
+	void DeleteRaw(T *pointer)
+	{
+		MEMALLOC_STAT(m_stats.onFreeShared());
+
+		UINT uSlot = MemAllocThreadSlot::Get();
+		if(uSlot >= MaxThreads)
+		{
+			ScopedSpinLock lock(m_lock);
+			m_depot.DeleteRaw(pointer);
+			return;
+		}
+
+		Magazine &mag = m_aMagazines[uSlot];
+		UINT uCount = mag.uCount.load(std::memory_order_relaxed);
+		if(uCount == MagazineSize)
+		{
+			ScopedSpinLock lock(m_lock);
+			for(; uCount > MagazineSize / 2; --uCount)
+			{
+				m_depot.DeleteRaw(mag.apCells[uCount - 1]);
+			}
+		}
+		mag.apCells[uCount++] = pointer;
+		mag.uCount.store(uCount, std::memory_order_relaxed);
+	}
+
+	//! возвращает ячейки из магазина текущего потока в общий пул
+	void flushThreadCache()
+	{
+		UINT uSlot = MemAllocThreadSlot::Get();
+		if(uSlot >= MaxThreads)
+		{
+			return;
+		}
+
+		Magazine &mag = m_aMagazines[uSlot];
+		UINT uCount = mag.uCount.load(std::memory_order_relaxed);
+		if(uCount)
+		{
+			ScopedSpinLock lock(m_lock);
+			for(UINT i = 0; i < uCount; ++i)
+			{
+				m_depot.DeleteRaw(mag.apCells[i]);
+			}
+			mag.uCount.store(0, std::memory_order_relaxed);
+		}
+	}
+
+	/*! статистика общего пула
+		@note ячейки в магазинах потоков учитываются как свободные, значение приблизительное
+	*/
+	void GetMemUsage(UsageStats *us)
+	{
+		UINT uCached = 0;
+		for(int i = 0; i < MaxThreads; ++i)
+		{
+			uCached += m_aMagazines[i].uCount.load(std::memory_order_relaxed);
+		}
+
+		ScopedSpinLock lock(m_lock);
+		m_depot.GetMemUsage(us);
+		uCached = min(uCached, us->uAllocCount);
+		us->uAllocCount -= uCached;
+		us->uFreeCount += uCached;
+		us->ulAllocMem = us->uAllocCount * sizeof(T);
+	}
+
+	/*! накопленная статистика выделений и освобождений пользователями пула,
+		память, полученная у системы, берется из общего пула. Без MEMALLOC_STATS заполняется нулями
+	*/
+	void GetStats(MemAllocStats *pStats) const
+	{
+		m_depot.GetStats(pStats);
+#ifdef MEMALLOC_STATS
+		MemAllocStats depotStats = *pStats;
+		m_stats.getStats(pStats);
+		pStats->ullSysMem = depotStats.ullSysMem;
+		pStats->ullPeakSysMem = depotStats.ullPeakSysMem;
+		pStats->ullGrowCount = depotStats.ullGrowCount;
+#endif
+	}
+
+	/*! имя пула в отчете MemAllocStatsNode::DumpReport.
+		Общий пул выводится отдельной безымянной записью, его счетчики - обмен с магазинами потоков
+	*/
+	void setName(const char *szName)
+	{
+		MEMALLOC_STAT(m_stats.setName(szName));
+	}
+
+	void releaseEmptyPages()
+	{
+		ScopedSpinLock lock(m_lock);
+		m_depot.releaseEmptyPages();
+	}
+
+private:
+	XALIGNED(struct, 64) Magazine
+	{
+		std::atomic<UINT> uCount{0};
+		T *apCells[MagazineSize];
+	};
+
+	Magazine m_aMagazines[MaxThreads];
+
+	SpinLock m_lock;
+	MemAlloc<T, SizeBlock, SizePage, alignBy, Layout> m_depot;
+#ifdef MEMALLOC_STATS
+	MemAllocStatsNode m_stats{sizeof(T)};
+#endif
+};
+
+#endif
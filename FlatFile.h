@@ -0,0 +1,623 @@
+/******************************************************
+Copyright © Vitaliy Buturlin, Evgeny Danilovich, 2017
+See the license in LICENSE
+******************************************************/
+
+#ifndef __COMMON_FLAT_FILE_H
+#define __COMMON_FLAT_FILE_H
+
+#include <common/array.h>
+#include <common/assotiativearray.h>
+#include <common/string.h>
+#include <stdio.h>
+#include <type_traits>
+
+#if defined(_WINDOWS)
+#	include <windows.h>
+#else
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <fcntl.h>
+#	include <unistd.h>
+#endif
+
+/*! Плоский файловый формат для Array и AssotiativeArray, пригодный для использования без десериализации.
+	Файл состоит из заголовка и секций, выровненных на FLAT_FILE_SECTION_ALIGN:
+		FlatFileHeader | ключи (отсортированы) | значения | пул строк
+	Массив хранится в секции ключей в исходном порядке, секция значений у него пустая.
+	Ключи и значения записываются как есть, поэтому должны быть тривиально копируемыми;
+	String хранится как FlatFileString - смещение и длина в пуле строк, строки в пуле завершаются нулем.
+	Файл отображается в память (FlatFileMapping) и читается через FlatArrayView/FlatMapView,
+	поиск в отображении - бинарный без ветвлений, загрузка не зависит от размера данных.
+	Пример:
+		FlatFileWrite("names.bin", mapNames);
+		...
+		FlatFileMapping file;
+		if(file.open("names.bin"))
+		{
+			FlatMapView<String, int> map(file.getData(), file.getSize());
+			const int *pValue = map.at("name");
+		}
+	@note данные для представлений должны быть выровнены на FLAT_FILE_SECTION_ALIGN, отображение файла выровнено на страницу
+	@note проверяются заголовок и границы секций, но не смещения строк внутри пула: файл должен быть записан FlatFileWrite
+	@note порядок байт и размеры типов не переносятся между платформами, файл с другим порядком байт отвергается по сигнатуре
+*/
+
+//! сигнатура файла, "XFLT"
+#define FLAT_FILE_MAGIC 0x544C4658
+#define FLAT_FILE_VERSION 1
+//! выравнивание секций файла
+#define FLAT_FILE_SECTION_ALIGN 64
+
+//! содержимое файла
+enum FLAT_FILE_KIND
+{
+	FLAT_FILE_KIND_ARRAY = 1,
+	FLAT_FILE_KIND_MAP = 2
+};
+
+struct FlatFileHeader
+{
+	UINT uMagic;
+	UINT uVersion;
+	UINT uKind;
+	//! количество элементов
+	UINT uCount;
+	//! размер хранимого ключа (элемента массива) и значения
+	UINT uKeySize;
+	UINT uValSize;
+	uint64_t ullKeysOffset;
+	uint64_t ullValsOffset;
+	uint64_t ullStringsOffset;
+	uint64_t ullStringsSize;
+	uint64_t ullFileSize;
+};
+
+//! строка в пуле строк файла
+struct FlatFileString
+{
+	UINT uOffset;
+	UINT uLength;
+};
+
+/*! Представление типа в файле: Stored - хранимый тип, Store - преобразование при записи,
+	Less/Equals - сравнение хранимого значения с искомым ключом, ключ другого типа приводится к T
+*/
+template<typename T>
+struct FlatFileType
+{
+	static_assert(std::is_trivially_copyable<T>::value, "FlatFile requires trivially copyable types");
+
+	typedef T Stored;
+
+	static Stored Store(const T &value, Array<char>&)
+	{
+		return(value);
+	}
+
+	static bool Less(const char*, const Stored &a, const T &b)
+	{
+		return(a < b);
+	}
+
+	//! вызывается для первого ключа, не меньшего b
+	static bool Equals(const char*, const Stored &a, const T &b)
+	{
+		return(!(b < a));
+	}
+};
+
+//! строки сравниваются побайтно как беззнаковые, что совпадает с порядком String::operator<
+template<>
+struct FlatFileType<String>
+{
+	typedef FlatFileString Stored;
+
+	static Stored Store(const String &value, Array<char> &aStrings)
+	{
+		Stored str;
+		str.uOffset = aStrings.size();
+		str.uLength = (UINT)value.length();
+		// resize растит пул геометрически, строка копируется вместе с завершающим нулем
+		aStrings.resize(str.uOffset + str.uLength + 1);
+		memcpy(aStrings.data() + str.uOffset, value.c_str(), str.uLength + 1);
+		return(str);
+	}
+
+	static bool Less(const char *pStrings, const Stored &a, const char *b)
+	{
+		return(strcmp(pStrings + a.uOffset, b) < 0);
+	}
+
+	static bool Less(const char *pStrings, const Stored &a, const String &b)
+	{
+		return(Less(pStrings, a, b.c_str()));
+	}
+
+	static bool Equals(const char *pStrings, const Stored &a, const char *b)
+	{
+		return(!strcmp(pStrings + a.uOffset, b));
+	}
+
+	static bool Equals(const char *pStrings, const Stored &a, const String &b)
+	{
+		return(a.uLength == b.length() && !memcmp(pStrings + a.uOffset, b.c_str(), a.uLength));
+	}
+};
+
+//! запись секций в файл
+class FlatFileWriter
+{
+public:
+	FlatFileWriter(const char *szPath):
+		m_pFile(fopen(szPath, "wb"))
+	{
+	}
+
+	~FlatFileWriter()
+	{
+		if(m_pFile)
+		{
+			fclose(m_pFile);
+		}
+	}
+
+	FlatFileWriter(const FlatFileWriter&) = delete;
+	FlatFileWriter& operator=(const FlatFileWriter&) = delete;
+
+	bool isOpen() const
+	{
+		return(m_pFile != NULL);
+	}
+
+	//! записывает заголовок и секции, заполняет смещения и размеры в header
+	bool write(FlatFileHeader &header, const void *pKeys, const void *pVals, const Array<char> &aStrings)
+	{
+		header.uMagic = FLAT_FILE_MAGIC;
+		header.uVersion = FLAT_FILE_VERSION;
+		header.ullKeysOffset = AlignSection(sizeof(FlatFileHeader));
+		header.ullValsOffset = AlignSection(header.ullKeysOffset + (uint64_t)header.uCount * header.uKeySize);
+		header.ullStringsOffset = AlignSection(header.ullValsOffset + (uint64_t)header.uCount * header.uValSize);
+		header.ullStringsSize = aStrings.size();
+		header.ullFileSize = header.ullStringsOffset + header.ullStringsSize;
+
+		return(
+			writeAt(0, &header, sizeof(header)) &&
+			writeAt(header.ullKeysOffset, pKeys, (size_t)header.uCount * header.uKeySize) &&
+			writeAt(header.ullValsOffset, pVals, (size_t)header.uCount * header.uValSize) &&
+			writeAt(header.ullStringsOffset, aStrings.data(), aStrings.size()) &&
+			!fflush(m_pFile)
+		);
+	}
+
+	static uint64_t AlignSection(uint64_t ullOffset)
+	{
+		return((ullOffset + FLAT_FILE_SECTION_ALIGN - 1) & ~(uint64_t)(FLAT_FILE_SECTION_ALIGN - 1));
+	}
+
+private:
+	//! дописывает нули до ullOffset и затем данные
+	bool writeAt(uint64_t ullOffset, const void *pData, size_t uSize)
+	{
+		static const byte s_aZero[FLAT_FILE_SECTION_ALIGN] = {};
+		if(ullOffset > m_ullPos)
+		{
+			size_t uPadding = (size_t)(ullOffset - m_ullPos);
+			if(fwrite(s_aZero, 1, uPadding, m_pFile) != uPadding)
+			{
+				return(false);
+			}
+			m_ullPos = ullOffset;
+		}
+		if(uSize && fwrite(pData, 1, uSize, m_pFile) != uSize)
+		{
+			return(false);
+		}
+		m_ullPos += uSize;
+		return(true);
+	}
+
+	FILE *m_pFile;
+	uint64_t m_ullPos = 0;
+};
+
+//! записывает массив в файл szPath
+template<typename T, int BlockSize, bool fully_defined, typename Allocator, typename Growth, UINT InlineCount>
+bool FlatFileWrite(const char *szPath, const Array<T, BlockSize, fully_defined, Allocator, Growth, InlineCount> &arr)
+{
+	typedef FlatFileType<T> Type;
+
+	FlatFileWriter writer(szPath);
+	if(!writer.isOpen())
+	{
+		return(false);
+	}
+
+	Array<char> aStrings;
+	Array<typename Type::Stored> aItems;
+	aItems.reserve(arr.size());
+	for(UINT i = 0, l = arr.size(); i < l; ++i)
+	{
+		aItems.push_back(Type::Store(arr[i], aStrings));
+	}
+
+	FlatFileHeader header = {};
+	header.uKind = FLAT_FILE_KIND_ARRAY;
+	header.uCount = aItems.size();
+	header.uKeySize = sizeof(typename Type::Stored);
+	return(writer.write(header, aItems.data(), NULL, aStrings));
+}
+
+//! записывает ассоциативный массив в файл szPath, ключи уже упорядочены деревом
+template<typename K, typename V, bool searchCache, int ReservePage, typename Allocator>
+bool FlatFileWrite(const char *szPath, const AssotiativeArray<K, V, searchCache, ReservePage, Allocator> &map)
+{
+	typedef FlatFileType<K> KeyType;
+	typedef FlatFileType<V> ValType;
+
+	FlatFileWriter writer(szPath);
+	if(!writer.isOpen())
+	{
+		return(false);
+	}
+
+	Array<char> aStrings;
+	Array<typename KeyType::Stored> aKeys;
+	Array<typename ValType::Stored> aVals;
+	aKeys.reserve(map.Size());
+	aVals.reserve(map.Size());
+	for(auto i = map.begin(); i; ++i)
+	{
+		aKeys.push_back(KeyType::Store(*i.first, aStrings));
+		aVals.push_back(ValType::Store(*i.second, aStrings));
+	}
+
+	FlatFileHeader header = {};
+	header.uKind = FLAT_FILE_KIND_MAP;
+	header.uCount = aKeys.size();
+	header.uKeySize = sizeof(typename KeyType::Stored);
+	header.uValSize = sizeof(typename ValType::Stored);
+	return(writer.write(header, aKeys.data(), aVals.data(), aStrings));
+}
+
+//! проверяет заголовок и границы секций
+inline const FlatFileHeader* FlatFileCheckHeader(const void *pData, size_t uSize, FLAT_FILE_KIND kind, UINT uKeySize, UINT uValSize)
+{
+	const FlatFileHeader *pHeader = (const FlatFileHeader*)pData;
+	if(!pData || uSize < sizeof(FlatFileHeader) || ((size_t)pData & (FLAT_FILE_SECTION_ALIGN - 1)))
+	{
+		return(NULL);
+	}
+	if(pHeader->uMagic != FLAT_FILE_MAGIC || pHeader->uVersion != FLAT_FILE_VERSION || pHeader->uKind != (UINT)kind
+		|| pHeader->uKeySize != uKeySize || pHeader->uValSize != uValSize || pHeader->ullFileSize > uSize)
+	{
+		return(NULL);
+	}
+	// каждое смещение сначала ограничивается размером файла, поэтому разности ниже не переполняются
+	if(pHeader->ullKeysOffset > pHeader->ullFileSize || pHeader->ullValsOffset > pHeader->ullFileSize
+		|| pHeader->ullStringsOffset > pHeader->ullFileSize || pHeader->ullStringsSize > pHeader->ullFileSize)
+	{
+		return(NULL);
+	}
+	if(pHeader->ullKeysOffset < sizeof(FlatFileHeader)
+		|| pHeader->ullValsOffset < pHeader->ullKeysOffset || pHeader->ullStringsOffset < pHeader->ullValsOffset
+		|| (uint64_t)pHeader->uCount * uKeySize > pHeader->ullValsOffset - pHeader->ullKeysOffset
+		|| (uint64_t)pHeader->uCount * uValSize > pHeader->ullStringsOffset - pHeader->ullValsOffset
+		|| pHeader->ullStringsSize > pHeader->ullFileSize - pHeader->ullStringsOffset
+		|| ((pHeader->ullKeysOffset | pHeader->ullValsOffset) & (FLAT_FILE_SECTION_ALIGN - 1)))
+	{
+		return(NULL);
+	}
+	if(pHeader->ullStringsSize && ((const char*)pData)[pHeader->ullStringsOffset + pHeader->ullStringsSize - 1])
+	{
+		return(NULL);
+	}
+	return(pHeader);
+}
+
+/*! Отображение файла в память только для чтения.
+	Страницы подгружаются системой при первом обращении, данные выровнены на страницу
+*/
+class FlatFileMapping
+{
+public:
+	FlatFileMapping() = default;
+
+	~FlatFileMapping()
+	{
+		close();
+	}
+
+	FlatFileMapping(const FlatFileMapping&) = delete;
+	FlatFileMapping& operator=(const FlatFileMapping&) = delete;
+
+	bool open(const char *szPath)
+	{
+		close();
+
+#if defined(_WINDOWS)
+		m_hFile = CreateFileA(szPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+		if(m_hFile == INVALID_HANDLE_VALUE)
+		{
+			return(false);
+		}
+		LARGE_INTEGER size;
+		if(!GetFileSizeEx(m_hFile, &size) || !size.QuadPart)
+		{
+			close();
+			return(false);
+		}
+		m_hMapping = CreateFileMappingA(m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		if(!m_hMapping)
+		{
+			close();
+			return(false);
+		}
+		m_pData = MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+		if(!m_pData)
+		{
+			close();
+			return(false);
+		}
+		m_uSize = (size_t)size.QuadPart;
+#else
+		int fd = ::open(szPath, O_RDONLY);
+		if(fd < 0)
+		{
+			return(false);
+		}
+		struct stat st;
+		if(fstat(fd, &st) || !st.st_size)
+		{
+			::close(fd);
+			return(false);
+		}
+		void *pData = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		// отображение удерживает файл, дескриптор больше не нужен
+		::close(fd);
+		if(pData == MAP_FAILED)
+		{
+			return(false);
+		}
+		m_pData = pData;
+		m_uSize = (size_t)st.st_size;
+#endif
+		return(true);
+	}
+
+	void close()
+	{
+#if defined(_WINDOWS)
+		if(m_pData)
+		{
+			UnmapViewOfFile(m_pData);
+		}
+		if(m_hMapping)
+		{
+			CloseHandle(m_hMapping);
+			m_hMapping = NULL;
+		}
+		if(m_hFile != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(m_hFile);
+			m_hFile = INVALID_HANDLE_VALUE;
+		}
+#else
+		if(m_pData)
+		{
+			munmap((void*)m_pData, m_uSize);
+		}
+#endif
+		m_pData = NULL;
+		m_uSize = 0;
+	}
+
+	const void* getData() const
+	{
+		return(m_pData);
+	}
+
+	size_t getSize() const
+	{
+		return(m_uSize);
+	}
+
+private:
+	const void *m_pData = NULL;
+	size_t m_uSize = 0;
+#if defined(_WINDOWS)
+	HANDLE m_hFile = INVALID_HANDLE_VALUE;
+	HANDLE m_hMapping = NULL;
+#endif
+};
+
+/*! Массив из плоского файла, данные не копируются.
+	@note представление действительно, пока существует отображение файла
+*/
+template<typename T>
+class FlatArrayView
+{
+	typedef FlatFileType<T> Type;
+public:
+	typedef typename Type::Stored Stored;
+
+	FlatArrayView() = default;
+
+	FlatArrayView(const void *pData, size_t uSize)
+	{
+		init(pData, uSize);
+	}
+
+	//! проверяет данные файла, при ошибке представление остается пустым
+	bool init(const void *pData, size_t uSize)
+	{
+		m_pHeader = FlatFileCheckHeader(pData, uSize, FLAT_FILE_KIND_ARRAY, sizeof(Stored), 0);
+		return(isValid());
+	}
+
+	bool isValid() const
+	{
+		return(m_pHeader != NULL);
+	}
+
+	UINT size() const
+	{
+		return(m_pHeader ? m_pHeader->uCount : 0);
+	}
+
+	const Stored& operator[](UINT key) const
+	{
+		return(data()[key]);
+	}
+
+	const Stored* data() const
+	{
+		return(m_pHeader ? (const Stored*)((const byte*)m_pHeader + m_pHeader->ullKeysOffset) : NULL);
+	}
+
+	ArrayView<const Stored> getView() const
+	{
+		ArrayView<const Stored> view = {data(), size()};
+		return(view);
+	}
+
+	//! строка из пула для элементов типа String
+	const char* getString(const FlatFileString &str) const
+	{
+		return((const char*)m_pHeader + m_pHeader->ullStringsOffset + str.uOffset);
+	}
+
+private:
+	const FlatFileHeader *m_pHeader = NULL;
+};
+
+/*! Ассоциативный массив только для чтения из плоского файла, данные не копируются.
+	Ключи хранятся отсортированными, поиск - бинарный без ветвлений (как Array::lowerBound).
+	Для ключей String поиск принимает const char* и String, значения String возвращаются как FlatFileString (см. getString)
+	@note представление действительно, пока существует отображение файла
+*/
+template<typename K, typename V>
+class FlatMapView
+{
+	typedef FlatFileType<K> KeyType;
+	typedef FlatFileType<V> ValType;
+public:
+	typedef typename KeyType::Stored StoredKey;
+	typedef typename ValType::Stored StoredVal;
+
+	FlatMapView() = default;
+
+	FlatMapView(const void *pData, size_t uSize)
+	{
+		init(pData, uSize);
+	}
+
+	//! проверяет данные файла, при ошибке представление остается пустым
+	bool init(const void *pData, size_t uSize)
+	{
+		m_pHeader = FlatFileCheckHeader(pData, uSize, FLAT_FILE_KIND_MAP, sizeof(StoredKey), sizeof(StoredVal));
+		if(m_pHeader)
+		{
+			m_pKeys = (const StoredKey*)((const byte*)pData + m_pHeader->ullKeysOffset);
+			m_pVals = (const StoredVal*)((const byte*)pData + m_pHeader->ullValsOffset);
+			m_pStrings = (const char*)pData + m_pHeader->ullStringsOffset;
+			m_uCount = m_pHeader->uCount;
+		}
+		else
+		{
+			m_pKeys = NULL;
+			m_pVals = NULL;
+			m_pStrings = NULL;
+			m_uCount = 0;
+		}
+		return(isValid());
+	}
+
+	bool isValid() const
+	{
+		return(m_pHeader != NULL);
+	}
+
+	UINT Size() const
+	{
+		return(m_uCount);
+	}
+
+	const StoredKey& getKey(UINT uIndex) const
+	{
+		return(m_pKeys[uIndex]);
+	}
+
+	const StoredVal& getVal(UINT uIndex) const
+	{
+		return(m_pVals[uIndex]);
+	}
+
+	//! строка из пула для ключей и значений типа String
+	const char* getString(const FlatFileString &str) const
+	{
+		return(m_pStrings + str.uOffset);
+	}
+
+	//! индекс первого ключа, не меньшего key, или Size()
+	template<typename O>
+	UINT lowerBound(const O &key) const
+	{
+		if(!m_uCount)
+		{
+			return(0);
+		}
+		const StoredKey *pBase = m_pKeys;
+		UINT uLen = m_uCount;
+		while(uLen > 1)
+		{
+			UINT uHalf = uLen / 2;
+			pBase = KeyType::Less(m_pStrings, pBase[uHalf], key) ? pBase + uHalf : pBase;
+			uLen -= uHalf;
+		}
+		return((UINT)(pBase - m_pKeys) + (KeyType::Less(m_pStrings, *pBase, key) ? 1 : 0));
+	}
+
+	//! индекс ключа или -1
+	template<typename O>
+	int indexOf(const O &key) const
+	{
+		UINT uIndex = lowerBound(key);
+		if(uIndex < m_uCount && KeyType::Equals(m_pStrings, m_pKeys[uIndex], key))
+		{
+			return((int)uIndex);
+		}
+		return(-1);
+	}
+
+	template<typename O>
+	bool KeyExists(const O &key, const StoredVal **ppVal = NULL) const
+	{
+		int iIndex = indexOf(key);
+		if(iIndex < 0)
+		{
+			return(false);
+		}
+		if(ppVal)
+		{
+			*ppVal = m_pVals + iIndex;
+		}
+		return(true);
+	}
+
+	template<typename O>
+	const StoredVal* at(const O &key) const
+	{
+		int iIndex = indexOf(key);
+		return(iIndex < 0 ? NULL : m_pVals + iIndex);
+	}
+
+private:
+	const FlatFileHeader *m_pHeader = NULL;
+	const StoredKey *m_pKeys = NULL;
+	const StoredVal *m_pVals = NULL;
+	const char *m_pStrings = NULL;
+	UINT m_uCount = 0;
+};
+
+#endif
@@ -0,0 +1,470 @@
+/******************************************************
+Copyright © Vitaliy Buturlin, Evgeny Danilovich, 2017
+See the license in LICENSE
+******************************************************/
+
+#ifndef __COMMON_HASH_MAP_H
+#define __COMMON_HASH_MAP_H
+
+#include <common/MemAlloc.h>
+#include <common/hash.h>
+#include <emmintrin.h>
+
+//! количество управляющих байт, проверяемых одной SSE2 инструкцией
+#define HASH_MAP_GROUP_WIDTH 16
+
+/*! Хеш-таблица с открытой адресацией (схема SwissTable) с интерфейсом AssotiativeArray.
+	На каждую ячейку приходится управляющий байт: пустая, удаленная или 7 младших бит хеша занятой.
+	Поиск сравнивает группу из HASH_MAP_GROUP_WIDTH управляющих байт с меткой ключа одной SSE2 инструкцией
+	и сравнивает ключи только у совпавших ячеек. Группы перебираются квадратичным шагом,
+	таблица расширяется вдвое при заполнении на 7/8.
+	Значения хранятся в пуле и не перемещаются при перестроении таблицы,
+	узлы (Node) перемещаются, поэтому указатели на Node действительны только до следующей вставки.
+	Порядок обхода не определен.
+	@note K должен иметь operator== и специализацию Hash (см. hash.h)
+*/
+template<typename K, typename V, typename Hash = XHash<K>, int ReservePage = 256, typename Allocator = HeapAllocator>
+class HashMap
+{
+public:
+	struct Node
+	{
+		K Key;
+		V *Val;
+	};
+
+	class Iterator
+	{
+	public:
+		const K *first;
+		V *second;
+
+		Iterator(const HashMap *pMap, UINT uIndex):
+			m_pMap(pMap),
+			m_uIndex(uIndex)
+		{
+			Seek();
+		}
+
+		bool operator==(const Iterator &c) const
+		{
+			return(c.m_uIndex == m_uIndex);
+		}
+
+		bool operator!=(const Iterator &c) const
+		{
+			return(c.m_uIndex != m_uIndex);
+		}
+
+		operator bool() const
+		{
+			return(m_uIndex < m_pMap->m_uCapacity);
+		}
+
+		Iterator& operator++()
+		{
+			++m_uIndex;
+			Seek();
+			return(*this);
+		}
+
+		Iterator operator++(int)
+		{
+			Iterator it = *this;
+			++(*this);
+			return(it);
+		}
+
+	private:
+		//! переходит к ближайшей занятой ячейке начиная с m_uIndex
+		void Seek()
+		{
+			while(m_uIndex < m_pMap->m_uCapacity && !IsFull(m_pMap->m_pCtrl[m_uIndex]))
+			{
+				++m_uIndex;
+			}
+
+			if(m_uIndex < m_pMap->m_uCapacity)
+			{
+				const Node &node = m_pMap->m_pSlots[m_uIndex];
+				first = &node.Key;
+				second = node.Val;
+			}
+			else
+			{
+				m_uIndex = m_pMap->m_uCapacity;
+				first = NULL;
+				second = NULL;
+			}
+		}
+
+		const HashMap *m_pMap;
+		UINT m_uIndex;
+	};
+
+	HashMap() = default;
+
+	HashMap(const HashMap &other)
+	{
+		*this = other;
+	}
+
+	~HashMap()
+	{
+		FreeTable();
+	}
+
+	HashMap& operator=(const HashMap &other)
+	{
+		if(&other != this)
+		{
+			clear();
+			reserve(other.m_uSize);
+			for(Iterator i = other.begin(); i; ++i)
+			{
+				insert(*i.first, *i.second);
+			}
+		}
+		return(*this);
+	}
+
+	bool KeyExists(const K &key, const Node **pNode = NULL) const
+	{
+		UINT uIndex = Find(key, Hash()(key));
+		if(pNode)
+		{
+			*pNode = uIndex == INVALID_INDEX ? NULL : &m_pSlots[uIndex];
+		}
+		return(uIndex != INVALID_INDEX);
+	}
+
+	//! при create == true отсутствующий ключ добавляется, возвращается true, только если ключ уже был
+	bool KeyExists(const K &key, const Node **pNode = NULL, bool create = false)
+	{
+		bool found = !create;
+		const Node *pFound = NULL;
+		if(create)
+		{
+			pFound = Insert(key, &found);
+		}
+		else
+		{
+			UINT uIndex = Find(key, Hash()(key));
+			pFound = uIndex == INVALID_INDEX ? NULL : &m_pSlots[uIndex];
+		}
+		if(pNode)
+		{
+			*pNode = pFound;
+		}
+		return(pFound != NULL && found);
+	}
+
+	//! добавляет ключ со значением, сконструированным из args, существующее значение не изменяется
+	template<typename... Args>
+	const Node* insert(const K &key, Args&&... args)
+	{
+		return(Insert(key, NULL, args...));
+	}
+
+	V& operator[](const K &key)
+	{
+		return(*Insert(key, NULL)->Val);
+	}
+
+	const V& operator[](const K &key) const
+	{
+		UINT uIndex = Find(key, Hash()(key));
+		assert(uIndex != INVALID_INDEX);
+		return(*m_pSlots[uIndex].Val);
+	}
+
+	const V* at(const K &key) const
+	{
+		UINT uIndex = Find(key, Hash()(key));
+		return(uIndex == INVALID_INDEX ? NULL : m_pSlots[uIndex].Val);
+	}
+
+	unsigned int Size() const
+	{
+		return(m_uSize);
+	}
+
+	void erase(const K &key)
+	{
+		UINT uIndex = Find(key, Hash()(key));
+		if(uIndex == INVALID_INDEX)
+		{
+			return;
+		}
+
+		Node &node = m_pSlots[uIndex];
+		m_memVals.Delete(node.Val);
+		node.~Node();
+		// ячейка могла быть пройдена при поиске других ключей, поэтому помечается удаленной, а не пустой
+		SetCtrl(uIndex, CTRL_DELETED);
+		--m_uSize;
+	}
+
+	void clear()
+	{
+		FreeTable();
+		m_memVals.clear();
+	}
+
+	//! подготавливает таблицу к хранению uCount элементов без перестроения
+	void reserve(UINT uCount)
+	{
+		if(uCount > m_uSize + m_uGrowthLeft)
+		{
+			Rehash(GetCapacityFor(uCount));
+		}
+	}
+
+	//! количество ячеек таблицы
+	UINT capacity() const
+	{
+		return(m_uCapacity);
+	}
+
+	Iterator begin() const
+	{
+		return(Iterator(this, 0));
+	}
+
+	Iterator end() const
+	{
+		return(Iterator(this, m_uCapacity));
+	}
+
+private:
+	static const char CTRL_EMPTY = (char)0x80;
+	static const char CTRL_DELETED = (char)0xFE;
+	static const UINT INVALID_INDEX = ~0u;
+	static const UINT MIN_CAPACITY = HASH_MAP_GROUP_WIDTH;
+
+	//! группа управляющих байт, загруженная в регистр
+	struct Group
+	{
+		__m128i ctrl;
+
+		Group(const char *pCtrl):
+			ctrl(_mm_loadu_si128((const __m128i*)pCtrl))
+		{
+		}
+
+		UINT match(char cTag) const
+		{
+			return((UINT)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(cTag), ctrl)));
+		}
+
+		UINT matchEmpty() const
+		{
+			return(match(CTRL_EMPTY));
+		}
+
+		//! у пустых и удаленных ячеек установлен старший бит
+		UINT matchEmptyOrDeleted() const
+		{
+			return((UINT)_mm_movemask_epi8(ctrl));
+		}
+	};
+
+	static bool IsFull(char cCtrl)
+	{
+		return(!(cCtrl & 0x80));
+	}
+
+	//! метка ячейки - младшие 7 бит хеша
+	static char GetTag(size_t uHash)
+	{
+		return((char)(uHash & 0x7F));
+	}
+
+	//! начальная позиция поиска - старшие биты хеша
+	static size_t GetPosition(size_t uHash)
+	{
+		return(uHash >> 7);
+	}
+
+	//! допустимое количество элементов в таблице из uCapacity ячеек
+	static UINT GetMaxLoad(UINT uCapacity)
+	{
+		return(uCapacity - uCapacity / 8);
+	}
+
+	static UINT GetCapacityFor(UINT uCount)
+	{
+		UINT uCapacity = MIN_CAPACITY;
+		while(GetMaxLoad(uCapacity) < uCount)
+		{
+			uCapacity *= 2;
+		}
+		return(uCapacity);
+	}
+
+	static size_t GetTableBytes(UINT uCapacity)
+	{
+		return(sizeof(Node) * uCapacity + uCapacity + HASH_MAP_GROUP_WIDTH);
+	}
+
+	static size_t GetTableAlign()
+	{
+		return(alignof(Node) > 16 ? alignof(Node) : 16);
+	}
+
+	/*! записывает управляющий байт,
+		первые HASH_MAP_GROUP_WIDTH байт продублированы после конца таблицы, чтобы группу можно было читать с любой позиции
+	*/
+	void SetCtrl(UINT uIndex, char cCtrl)
+	{
+		m_pCtrl[uIndex] = cCtrl;
+		if(uIndex < HASH_MAP_GROUP_WIDTH)
+		{
+			m_pCtrl[m_uCapacity + uIndex] = cCtrl;
+		}
+	}
+
+	UINT Find(const K &key, size_t uHash) const
+	{
+		if(!m_uSize)
+		{
+			return(INVALID_INDEX);
+		}
+
+		char cTag = GetTag(uHash);
+		UINT uMask = m_uCapacity - 1;
+		UINT uPos = (UINT)GetPosition(uHash) & uMask;
+		for(UINT uStep = HASH_MAP_GROUP_WIDTH; ; uStep += HASH_MAP_GROUP_WIDTH)
+		{
+			Group group(m_pCtrl + uPos);
+			for(UINT uBits = group.match(cTag); uBits; uBits &= uBits - 1)
+			{
+				UINT uIndex = (uPos + MemAllocLowestBit(uBits)) & uMask;
+				if(m_pSlots[uIndex].Key == key)
+				{
+					return(uIndex);
+				}
+			}
+			if(group.matchEmpty())
+			{
+				return(INVALID_INDEX);
+			}
+			uPos = (uPos + uStep) & uMask;
+		}
+	}
+
+	//! первая пустая или удаленная ячейка на пути поиска ключа с хешем uHash
+	UINT FindInsertSlot(size_t uHash) const
+	{
+		UINT uMask = m_uCapacity - 1;
+		UINT uPos = (UINT)GetPosition(uHash) & uMask;
+		for(UINT uStep = HASH_MAP_GROUP_WIDTH; ; uStep += HASH_MAP_GROUP_WIDTH)
+		{
+			UINT uBits = Group(m_pCtrl + uPos).matchEmptyOrDeleted();
+			if(uBits)
+			{
+				return((uPos + MemAllocLowestBit(uBits)) & uMask);
+			}
+			uPos = (uPos + uStep) & uMask;
+		}
+	}
+
+	template<typename... Args>
+	Node* Insert(const K &key, bool *found, Args&&... args)
+	{
+		size_t uHash = Hash()(key);
+		UINT uIndex = Find(key, uHash);
+		if(uIndex != INVALID_INDEX)
+		{
+			if(found)
+			{
+				*found = true;
+			}
+			return(&m_pSlots[uIndex]);
+		}
+
+		if(!m_uGrowthLeft)
+		{
+			// если таблица в основном занята удаленными ячейками, перестраиваем ее без расширения
+			UINT uCapacity = GetCapacityFor(m_uSize + 1);
+			Rehash(uCapacity > m_uCapacity || m_uSize >= GetMaxLoad(m_uCapacity) / 2 ? max(uCapacity, m_uCapacity * 2) : m_uCapacity);
+		}
+
+		uIndex = FindInsertSlot(uHash);
+		if(m_pCtrl[uIndex] == CTRL_EMPTY)
+		{
+			--m_uGrowthLeft;
+		}
+		SetCtrl(uIndex, GetTag(uHash));
+
+		Node *pNode = &m_pSlots[uIndex];
+		new(&pNode->Key) K(key);
+		pNode->Val = m_memVals.Alloc(args...);
+		++m_uSize;
+		return(pNode);
+	}
+
+	void Rehash(UINT uCapacity)
+	{
+		Node *pOldSlots = m_pSlots;
+		char *pOldCtrl = m_pCtrl;
+		UINT uOldCapacity = m_uCapacity;
+
+		m_pSlots = (Node*)Allocator::Alloc(GetTableBytes(uCapacity), GetTableAlign());
+		assert(m_pSlots);
+		m_pCtrl = (char*)(m_pSlots + uCapacity);
+		memset(m_pCtrl, CTRL_EMPTY, uCapacity + HASH_MAP_GROUP_WIDTH);
+		m_uCapacity = uCapacity;
+		m_uGrowthLeft = GetMaxLoad(uCapacity) - m_uSize;
+
+		for(UINT i = 0; i < uOldCapacity; ++i)
+		{
+			if(IsFull(pOldCtrl[i]))
+			{
+				Node &oldNode = pOldSlots[i];
+				size_t uHash = Hash()(oldNode.Key);
+				UINT uIndex = FindInsertSlot(uHash);
+				SetCtrl(uIndex, GetTag(uHash));
+				new(&m_pSlots[uIndex]) Node{std::move(oldNode.Key), oldNode.Val};
+				oldNode.~Node();
+			}
+		}
+
+		if(pOldSlots)
+		{
+			Allocator::Free(pOldSlots, GetTableBytes(uOldCapacity));
+		}
+	}
+
+	void FreeTable()
+	{
+		if(!m_pSlots)
+		{
+			return;
+		}
+		for(UINT i = 0; i < m_uCapacity; ++i)
+		{
+			if(IsFull(m_pCtrl[i]))
+			{
+				m_pSlots[i].~Node();
+			}
+		}
+		Allocator::Free(m_pSlots, GetTableBytes(m_uCapacity));
+		m_pSlots = NULL;
+		m_pCtrl = NULL;
+		m_uCapacity = 0;
+		m_uSize = 0;
+		m_uGrowthLeft = 0;
+	}
+
+	Node *m_pSlots = NULL;
+	char *m_pCtrl = NULL;
+	UINT m_uCapacity = 0;
+	UINT m_uSize = 0;
+	//! сколько еще пустых ячеек можно занять до перестроения
+	UINT m_uGrowthLeft = 0;
+
+	MemAlloc<V, ReservePage, 8, alignof(V), MemAllocHeaderLayout, Allocator> m_memVals;
+};
+
+#endif
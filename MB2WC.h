@@ -1,18 +1,33 @@
 #ifndef __MB2WC__H
 #define __MB2WC__H
 
+#if !defined(_WIN32)
+#	include <stdlib.h>
+#	include <string.h>
+#endif
+
+/*! Преобразование многобайтовой строки в wchar_t.
+	На Windows - MultiByteToWideChar с кодовой страницей nCodePage (по умолчанию UTF-8),
+	на остальных платформах - mbstowcs в соответствии с текущей локалью
+*/
 template<int STATIC_MAX = 256>
 class CMB2WCEx
 {
 public:
 	CMB2WCEx(const char *szInput)
 	{
+#if defined(_WIN32)
 		init(szInput, CP_UTF8);
+#else
+		init(szInput);
+#endif
 	}
+#if defined(_WIN32)
 	CMB2WCEx(const char *szInput, UINT nCodePage)
 	{
 		init(szInput, nCodePage);
 	}
+#endif
 	~CMB2WCEx()
 	{
 		delete[] m_psz;
@@ -24,6 +39,7 @@ public:
 	}
 
 private:
+#if defined(_WIN32)
 	void init(const char *szInput, UINT nCodePage)
 	{
 		m_szBuffer[0] = 0;
@@ -43,6 +59,29 @@ private:
 			isFailed = (0 == MultiByteToWideChar(nCodePage, 0, szInput, nLengthA, m_psz, nLengthW));
 		}
 	}
+#else
+	void init(const char *szInput)
+	{
+		m_szBuffer[0] = 0;
+		if(!szInput)
+		{
+			m_psz = NULL;
+			return;
+		}
+		size_t uLength = mbstowcs(NULL, szInput, 0);
+		if(uLength == (size_t)-1)
+		{
+			// недопустимая последовательность в текущей локали
+			m_psz = NULL;
+			return;
+		}
+		if(uLength >= STATIC_MAX)
+		{
+			m_psz = new wchar_t[uLength + 1];
+		}
+		mbstowcs(m_psz ? m_psz : m_szBuffer, szInput, uLength + 1);
+	}
+#endif
 
 public:
 	wchar_t *m_psz = NULL;
@@ -16,8 +16,13 @@ See the license in LICENSE
 #	include <new>
 #endif
 #include "types.h"
+#include "Allocator.h"
+#include "MemAllocStats.h"
+#include "array.h"
+#include <utility>
 #include <malloc.h>
 #if defined(_WINDOWS)
+#	include <intrin.h>
 #	pragma warning(push)
 #	pragma warning(disable:4018)
 #endif
@@ -27,6 +32,18 @@ See the license in LICENSE
 #	pragma GCC diagnostic ignored "-Wsign-compare"
 #endif
 
+//! номер младшего установленного бита, uBits != 0
+__forceinline UINT MemAllocLowestBit(UINT uBits)
+{
+#if defined(_WINDOWS)
+	unsigned long ulIndex;
+	_BitScanForward(&ulIndex, uBits);
+	return((UINT)ulIndex);
+#else
+	return((UINT)__builtin_ctz(uBits));
+#endif
+}
+
 struct UsageStats
 {
 	UINT uAllocCount; // количество занятых элементов
@@ -35,328 +52,432 @@ struct UsageStats
 	ULONG ulAllocMem; //Количество занятой элементами памяти
 };
 
-template <typename T, int SizeBlock = 256, int SizePage = 16, const int alignBy = alignof(T)>
-class MemAlloc
+/*! Раскладка ячеек по умолчанию: перед каждым объектом хранится заголовок размером alignBy,
+	в котором у занятой ячейки записан номер блока, а у свободной - номер следующей свободной ячейки
+*/
+struct MemAllocHeaderLayout
 {
-	static_assert(alignBy % alignof(T) == 0 && alignBy >= alignof(T), "alignBy should be multiply of alignof(T)");
-	
-#undef MEMALLOC_DEFAULT_ALIGN
-#undef MEMALLOC_DEFAULT_ALIGN_STR
+	template <typename T, int SizeBlock, int alignBy>
+	struct Impl
+	{
+		static const size_t HEADER_SIZE = alignBy < sizeof(UINT) ? sizeof(UINT) : alignBy;
 
 #pragma pack(push, 1)
-	struct MemCell
-	{
-		union
+		struct MemCell
 		{
-			UINT IsFree;
-			byte _padding[alignBy];
+			union
+			{
+				UINT IsFree;
+				byte _padding[HEADER_SIZE];
+			};
+			T data;
 		};
-		T data;
-	};
 #pragma pack(pop)
-	struct AlignTest
+
+		static const UINT BLOCK_CELLS = SizeBlock;
+		static const size_t BLOCK_ALIGN = alignBy;
+
+		static size_t GetBlockBytes(UINT uCells)
+		{
+			return(uCells * sizeof(MemCell));
+		}
+
+		static void InitBlock(byte*, UINT)
+		{
+		}
+
+		static T* GetData(byte *pMem, UINT uCell)
+		{
+			return(&((MemCell*)pMem)[uCell].data);
+		}
+
+		static UINT& NextFree(byte *pMem, UINT uCell)
+		{
+			return(((MemCell*)pMem)[uCell].IsFree);
+		}
+
+		static void MarkUsed(byte *pMem, UINT uCell, UINT uBlock)
+		{
+			((MemCell*)pMem)[uCell].IsFree = uBlock;
+		}
+
+		static UINT FindBlock(const T *pData)
+		{
+			return(*(UINT*)((intptr_t)pData - HEADER_SIZE));
+		}
+
+		static UINT FindCell(const T *pData, const byte *pMem)
+		{
+			return((UINT)(((intptr_t)pData - HEADER_SIZE - (intptr_t)pMem) / sizeof(MemCell)));
+		}
+	};
+};
+
+/*! Плотная раскладка ячеек: объекты лежат подряд с шагом sizeof(T) без заголовков.
+	Блок выделяется выровненным на свой размер (степень двойки), в его начале лежит заголовок
+	с номером блока, который находится по адресу объекта наложением маски.
+	Ячейки вмещают до следующей степени двойки, поэтому их в блоке может быть больше, чем SizeBlock.
+	@note sizeof(T) должен быть не меньше sizeof(UINT), свободная ячейка хранит ссылку на следующую
+*/
+template <UINT uChunkTag = 0>
+struct MemAllocPackedLayout
+{
+	//! заголовок блока, общий для всех типов
+	struct ChunkHeader
 	{
-		char start;
-		T end;
+		UINT uBlockID;
+		UINT uTag;
 	};
+
+	//! заголовок блока, которому принадлежит pData
+	template <size_t uChunkBytes>
+	static const ChunkHeader* GetChunkHeader(const void *pData)
+	{
+		return((const ChunkHeader*)((intptr_t)pData & ~(intptr_t)(uChunkBytes - 1)));
+	}
+
+	template <typename T, int SizeBlock, int alignBy>
+	struct Impl
+	{
+		static_assert(sizeof(T) >= sizeof(UINT), "MemAllocPackedLayout requires sizeof(T) >= sizeof(UINT)");
+
+		static const size_t CELL_SIZE = MemAllocAlignUp(sizeof(T), alignBy);
+		static const size_t HEADER_SIZE = MemAllocAlignUp(sizeof(ChunkHeader), alignBy);
+		static const size_t CHUNK_BYTES = MemAllocNextPow2(HEADER_SIZE + SizeBlock * CELL_SIZE);
+		static const UINT BLOCK_CELLS = (UINT)((CHUNK_BYTES - HEADER_SIZE) / CELL_SIZE);
+		static const size_t BLOCK_ALIGN = CHUNK_BYTES;
+
+		static size_t GetBlockBytes(UINT)
+		{
+			return(CHUNK_BYTES);
+		}
+
+		static void InitBlock(byte *pMem, UINT uBlock)
+		{
+			ChunkHeader *pHeader = (ChunkHeader*)pMem;
+			pHeader->uBlockID = uBlock;
+			pHeader->uTag = uChunkTag;
+		}
+
+		static T* GetData(byte *pMem, UINT uCell)
+		{
+			return((T*)(pMem + HEADER_SIZE + uCell * CELL_SIZE));
+		}
+
+		static UINT& NextFree(byte *pMem, UINT uCell)
+		{
+			return(*(UINT*)GetData(pMem, uCell));
+		}
+
+		static void MarkUsed(byte*, UINT, UINT)
+		{
+		}
+
+		static UINT FindBlock(const T *pData)
+		{
+			return(GetChunkHeader<CHUNK_BYTES>(pData)->uBlockID);
+		}
+
+		static UINT FindCell(const T *pData, const byte *pMem)
+		{
+			return((UINT)(((intptr_t)pData - (intptr_t)pMem - HEADER_SIZE) / CELL_SIZE));
+		}
+	};
+};
+
+/*! Пул объектов типа T.
+	Layout - раскладка ячеек в блоке (MemAllocHeaderLayout, MemAllocPackedLayout),
+	Allocator - стратегия выделения памяти под блоки (см. Allocator.h)
+*/
+template <typename T, int SizeBlock = 256, int SizePage = 16, const int alignBy = alignof(T), typename Layout = MemAllocHeaderLayout, typename Allocator = HeapAllocator>
+class MemAlloc
+{
+	static_assert(alignBy % alignof(T) == 0 && alignBy >= alignof(T), "alignBy should be multiply of alignof(T)");
+	
+#undef MEMALLOC_DEFAULT_ALIGN
+#undef MEMALLOC_DEFAULT_ALIGN_STR
+
+	typedef typename Layout::template Impl<T, SizeBlock, alignBy> LayoutImpl;
+
+	/*
+		Занятость ячеек блока хранится в битовой маске usedBits.
+		Свободные ячейки блока связаны в список через LayoutImpl::NextFree, конец списка обозначается номером size.
+		Блоки, в которых есть свободные ячейки, связаны в двусвязный список nextFree/prevFree,
+		освобожденные releaseEmptyPages слоты блоков - в односвязный список через nextFree
+	*/
 	struct MemBlock
 	{
-		MemCell * mem;
+		byte * mem;
 		UINT size;
 		UINT pos;
 		UINT used;
+		int nextFree;
+		int prevFree;
+		UINT usedBits[(LayoutImpl::BLOCK_CELLS + 31) / 32];
 	};
 	MemBlock * memblocks;
-	int NumCurBlock;
 	int NumCurBlockCount;
+	int NumFilledBlocks;
+	int FirstFreeBlock;
+	int FirstSpareBlock;
+#ifdef MEMALLOC_STATS
+	MemAllocStatsNode m_stats{sizeof(T)};
+#endif
 public:
 	
-	MemAlloc():memblocks(NULL), NumCurBlock(0), NumCurBlockCount(0)
+	//! первый блок выделяется при первом Alloc
+	MemAlloc():memblocks(NULL), NumCurBlockCount(0), NumFilledBlocks(0), FirstFreeBlock(-1), FirstSpareBlock(-1)
 	{
-	//	static_assert((intptr_t)(&(((AlignTest*)0)->end)) - (intptr_t)(((AlignTest*)0)->start) == alignBy, "Invalid align specified!");
-		AllocBlock();
 	}
 
-	MemAlloc(const MemAlloc & al)
+	MemAlloc(const MemAlloc & al):memblocks(NULL), NumCurBlockCount(0), NumFilledBlocks(0), FirstFreeBlock(-1), FirstSpareBlock(-1)
 	{
-		//printf("MemAlloc()\n");
-		this->NumCurBlock = al.NumCurBlock;
-		this->NumCurBlockCount = al.NumCurBlockCount;
-		this->memblocks = new MemBlock[this->NumCurBlockCount];
-		//SX_DBG_NEW(this->NumCurBlockCount * sizeof(MemBlock), this->memblocks);
-		for(int i = 0; i < this->NumCurBlockCount; i++)
-		{
-			this->memblocks[i].size = al.memblocks[i].size;
-			this->memblocks[i].pos = al.memblocks[i].pos;
-			this->memblocks[i].mem = (MemCell*)_aligned_malloc(al.memblocks[i].size * sizeof(MemCell), alignBy);
-			//SX_DBG_NEW(al.memblocks[i].size, this->memblocks[i].mem);
-			for(int j = 0; j < al.memblocks[i].size; j++)
-			{
-				this->memblocks[i].mem[j].IsFree = al.memblocks[i].mem[j].IsFree;
-				this->memblocks[i].mem[j].data = al.memblocks[i].mem[j].data;
-			}
-			//SX_SAFE_DELETE_A(memblocks[i].mem);
-		}
+		CopyFrom(al);
 	}
 
 	MemAlloc & operator=(const MemAlloc & al)
-	{//clear mem
+	{
 		if(&al != this)
 		{
-			for(int i = 0; i < this->NumCurBlockCount; i++)
-			{
-				if(this->memblocks[i].mem)
-				{
-					for(int j = 0; j < this->memblocks[i].size; j++)
-					{
-						if(!(this->memblocks[i].mem[j].IsFree & 0x80000000))
-						{
-							this->memblocks[i].mem[j].data.~T();
-						}
-
-					}
-					_aligned_free(this->memblocks[i].mem);
-				}
-				//SX_SAFE_DELETE_A(this->memblocks[i].mem);
-			}
-			mem_delete_a(this->memblocks);
-
-			this->NumCurBlock = al.NumCurBlock;
-			this->NumCurBlockCount = al.NumCurBlockCount;
-			this->memblocks = new MemBlock[this->NumCurBlockCount];
-			//SX_DBG_NEW(this->NumCurBlockCount * sizeof(MemBlock), this->memblocks);
-			for(int i = 0; i < this->NumCurBlockCount; i++)
-			{
-				this->memblocks[i].size = al.memblocks[i].size;
-				this->memblocks[i].pos = al.memblocks[i].pos;
-
-				if(!this->memblocks[i].size)
-				{
-					this->memblocks[i].mem = NULL;
-				}
-				else
-				{
-					this->memblocks[i].mem = (MemCell*)_aligned_malloc(al.memblocks[i].size * sizeof(MemCell), alignBy);
-					//SX_DBG_NEW(al.memblocks[i].size, this->memblocks[i].mem);
-					for(int j = 0; (unsigned int)j < al.memblocks[i].size; j++)
-					{
-						this->memblocks[i].mem[j].IsFree = al.memblocks[i].mem[j].IsFree;
-						if(!(al.memblocks[i].mem[j].IsFree & 0x80000000))
-						{
-							this->memblocks[i].mem[j].data = al.memblocks[i].mem[j].data;
-						}
-					}
-				}
-				//SX_SAFE_DELETE_A(memblocks[i].mem);
-			}
+			clear();
+			CopyFrom(al);
 		}
 		return(*this);
 	}
 
 	~MemAlloc()
 	{
-		//printf("~MemAlloc()\n");
-		for(int i = 0; i < this->NumCurBlockCount; i++)
+		clear();
+	}
+
+	void clear()
+	{
+		for(int i = 0; i < this->NumFilledBlocks; i++)
 		{
 			if(this->memblocks[i].mem)
 			{
-				for(int j = 0; j < this->memblocks[i].size; j++)
-				{
-					if(!(this->memblocks[i].mem[j].IsFree & 0x80000000))
-					{
-						this->memblocks[i].mem[j].data.~T();
-					}
-
-				}
-				_aligned_free(this->memblocks[i].mem);
+				DestructBlock(i);
+				FreeBlockMem(i);
 			}
-			//SX_SAFE_DELETE_A(this->memblocks[i].mem);
 		}
-		mem_delete_a(this->memblocks);
+		FreeBlockList(this->memblocks, this->NumCurBlockCount);
+		MEMALLOC_STAT(m_stats.onSysFree(this->NumCurBlockCount * sizeof(MemBlock)));
+		this->memblocks = NULL;
 		this->NumCurBlockCount = 0;
-		this->NumCurBlock = 0;
+		this->NumFilledBlocks = 0;
+		this->FirstFreeBlock = -1;
+		this->FirstSpareBlock = -1;
+		//AllocBlock();
 	}
 
-	void clear()
+	void clearFast()
 	{
-		for(int i = 0; i < this->NumCurBlockCount; i++)
+		this->FirstFreeBlock = -1;
+		for(int i = this->NumFilledBlocks - 1; i >= 0; i--)
 		{
 			if(this->memblocks[i].mem)
 			{
-				for(int j = 0; j < this->memblocks[i].size; j++)
-				{
-					if(!(this->memblocks[i].mem[j].IsFree & 0x80000000))
-					{
-						(&(this->memblocks[i].mem[j].data))->~T();
-					}
-				}
-				_aligned_free(this->memblocks[i].mem);
+				DestructBlock(i);
+				InitFreeList(i);
+				LinkFreeBlock(i);
 			}
-			//SX_SAFE_DELETE_A(this->memblocks[i].mem);
 		}
-		mem_delete_a(this->memblocks);
-		this->NumCurBlockCount = 0;
-		this->NumCurBlock = 0;
-		//AllocBlock();
 	}
 
-	void clearFast()
+	void AllocBlock(UINT size = SizeBlock)
 	{
-		for(int i = 0; i < this->NumCurBlockCount; i++)
+		int iBlock = this->FirstSpareBlock;
+		if(iBlock >= 0)
 		{
-			if(this->memblocks[i].mem && this->memblocks[i].used)
+			this->FirstSpareBlock = this->memblocks[iBlock].nextFree;
+		}
+		else
+		{
+			if(this->NumFilledBlocks == this->NumCurBlockCount)
 			{
-				for(int j = 0; j < this->memblocks[i].size; j++)
+				MemBlock * tmpMB = this->memblocks;
+
+				NumCurBlockCount += SizePage;
+
+				this->memblocks = AllocBlockList(NumCurBlockCount);
+				MEMALLOC_STAT(m_stats.onSysAlloc(SizePage * sizeof(MemBlock)));
+				if(tmpMB)
 				{
-					if(!(this->memblocks[i].mem[j].IsFree & 0x80000000))
-					{
-						(&(this->memblocks[i].mem[j].data))->~T();
-					}
-					this->memblocks[i].mem[j].IsFree = 0x80000000 | (j + 1);
+					memcpy(this->memblocks, tmpMB, (NumCurBlockCount - SizePage) * sizeof(MemBlock));
 				}
-				this->memblocks[i].pos = 0;
-				this->memblocks[i].used = 0;
+				memset(this->memblocks + (NumCurBlockCount - SizePage), 0, SizePage * sizeof(MemBlock));
+				FreeBlockList(tmpMB, NumCurBlockCount - SizePage);
 			}
+			iBlock = this->NumFilledBlocks++;
 		}
-		this->NumCurBlock = 0;
+
+		UINT uMaxCells = LayoutImpl::BLOCK_CELLS;
+		assert(size <= uMaxCells);
+		FillBlock(iBlock, size >= SizeBlock ? uMaxCells : size);
 	}
 
-	void AllocBlock(UINT size = SizeBlock)
+	template<typename... Args>
+	T * Alloc(Args&&... args)
 	{
-		MemBlock * tmpMB = this->memblocks;
-
-		NumCurBlockCount += SizePage;
+		T * tmpNewNode = AllocRaw();
+		tmpNewNode = new (tmpNewNode)T(args...);
+		return(tmpNewNode);
+	}
 
-		this->memblocks = new MemBlock[NumCurBlockCount];
-		//SX_DBG_NEW(this->NumCurBlockCount * sizeof(MemBlock), this->memblocks);
-		if(tmpMB)
+	//! выделяет ячейку без вызова конструктора
+	T * AllocRaw()
+	{
+		if(this->FirstFreeBlock < 0)
 		{
-			memcpy(this->memblocks, tmpMB, (NumCurBlockCount - SizePage) * sizeof(MemBlock));
+			AllocBlock();
 		}
-		memset(this->memblocks + (NumCurBlockCount - SizePage), 0, SizePage * sizeof(MemBlock));
-		mem_delete_a(tmpMB);
 
+		int iBlock = this->FirstFreeBlock;
+		MemBlock * mb = &this->memblocks[iBlock];
+		UINT uCell = mb->pos;
+		assert(!IsUsed(mb, uCell));
+
+		mb->pos = LayoutImpl::NextFree(mb->mem, uCell);
+		LayoutImpl::MarkUsed(mb->mem, uCell, iBlock);
+		mb->usedBits[uCell >> 5] |= 1u << (uCell & 31);
+		++mb->used;
+		MEMALLOC_STAT(m_stats.onAlloc());
+
+		if(mb->pos >= mb->size)
+		{
+			UnlinkFreeBlock(iBlock);
+		}
 
-		FillCurrentBlock(size);
+		return(LayoutImpl::GetData(mb->mem, uCell));
 	}
 
-	__forceinline void FillCurrentBlock(UINT size = SizeBlock)
+	T * GetAt(int page, int offset)
 	{
-		if(!this->memblocks[NumCurBlock].mem)
+		if(IsUsed(&memblocks[page], offset))
 		{
-			this->memblocks[NumCurBlock].mem = (MemCell*)_aligned_malloc(size * sizeof(MemCell), alignBy);
-			//SX_DBG_NEW(size * sizeof(MemCell), this->memblocks[NumCurBlock].mem);
-			for(int i = 0; i < size; i++)
-			{
-				this->memblocks[NumCurBlock].mem[i].IsFree = 0x80000000 | (i + 1);
-			}
-			this->memblocks[NumCurBlock].size = size;
+			return(LayoutImpl::GetData(memblocks[page].mem, offset));
 		}
+		return(NULL);
 	}
 
-	template<typename... Args>
-	T * Alloc(Args&&... args)
+	//! последовательный обход живых объектов в порядке расположения в памяти
+	class Iterator
 	{
-		T * tmpNewNode = NULL;
-		if(!NumCurBlockCount)
+		friend class MemAlloc;
+
+		MemAlloc * m_pPool;
+		int m_iBlock;
+		UINT m_uCell;
+
+		Iterator(MemAlloc * pPool, int iBlock, UINT uCell):m_pPool(pPool), m_iBlock(iBlock), m_uCell(uCell)
 		{
-			AllocBlock();
 		}
-		if(this->memblocks[NumCurBlock].pos < this->memblocks[NumCurBlock].size)
+
+		//! переходит к первой занятой ячейке, начиная с текущей
+		void Seek()
 		{
-			MemCell * mc = &(this->memblocks[NumCurBlock].mem[this->memblocks[NumCurBlock].pos]);
-			if(mc->IsFree & 0x80000000)
-			{
-				this->memblocks[NumCurBlock].pos = mc->IsFree & 0x7FFFFFFF;
-				mc->IsFree = NumCurBlock;
-				tmpNewNode = &(mc->data);
-			}
-			else // find next free cell
+			for(; m_iBlock < m_pPool->NumFilledBlocks; ++m_iBlock, m_uCell = 0)
 			{
-				while(true)
+				const MemBlock * mb = &m_pPool->memblocks[m_iBlock];
+				if(!mb->used)
 				{
-					++this->memblocks[NumCurBlock].pos;
-					if(this->memblocks[NumCurBlock].pos < this->memblocks[NumCurBlock].size)
+					continue;
+				}
+				for(UINT w = m_uCell >> 5, l = (mb->size + 31) >> 5; w < l; ++w)
+				{
+					UINT uBits = mb->usedBits[w];
+					if(w == (m_uCell >> 5))
 					{
-						mc = &(this->memblocks[NumCurBlock].mem[this->memblocks[NumCurBlock].pos]);
-						if(mc->IsFree)
-						{
-							this->memblocks[NumCurBlock].pos = mc->IsFree & 0x7FFFFFFF;
-							mc->IsFree = NumCurBlock;
-							tmpNewNode = &(mc->data);
-							break;
-						}
+						uBits &= ~0u << (m_uCell & 31);
 					}
-					else
+					if(uBits)
 					{
-						//next block
-						NumCurBlock++;
-						if(NumCurBlock < NumCurBlockCount)
-						{
-							FillCurrentBlock();
-						}
-						else
-						{
-							AllocBlock();
-						}
-						return(Alloc(args...));
+						m_uCell = (w << 5) + MemAllocLowestBit(uBits);
+						return;
 					}
 				}
 			}
+			m_uCell = 0;
 		}
-		else
+
+	public:
+		T & operator*() const
 		{
-			NumCurBlock++;
-			if(NumCurBlock < NumCurBlockCount)
-			{
-				FillCurrentBlock();
-			}
-			else
-			{
-				AllocBlock();
-			}
-			return(Alloc(args...));
+			return(*LayoutImpl::GetData(m_pPool->memblocks[m_iBlock].mem, m_uCell));
 		}
-		++this->memblocks[NumCurBlock].used;
-		tmpNewNode = new (tmpNewNode)T(args...);
-		return(tmpNewNode);
+
+		T * operator->() const
+		{
+			return(LayoutImpl::GetData(m_pPool->memblocks[m_iBlock].mem, m_uCell));
+		}
+
+		Iterator & operator++()
+		{
+			++m_uCell;
+			Seek();
+			return(*this);
+		}
+
+		bool operator==(const Iterator & other) const
+		{
+			return(m_iBlock == other.m_iBlock && m_uCell == other.m_uCell);
+		}
+
+		bool operator!=(const Iterator & other) const
+		{
+			return(!(*this == other));
+		}
+	};
+
+	Iterator begin()
+	{
+		Iterator it(this, 0, 0);
+		it.Seek();
+		return(it);
 	}
 
-	T * GetAt(int page, int offset)
+	Iterator end()
 	{
-		if(!(memblocks[page].mem[offset].IsFree & 0x80000000))
+		return(Iterator(this, this->NumFilledBlocks, 0));
+	}
+
+	//! вызывает fn(T*) для каждого живого объекта в порядке расположения в памяти
+	template<typename L>
+	void forEach(const L & fn)
+	{
+		for(int i = 0; i < this->NumFilledBlocks; ++i)
 		{
-			return(&memblocks[page].mem[offset].data);
+			ForEachInBlock(i, fn);
 		}
-		return(NULL);
 	}
 
 	void Delete(T * pointer)
+	{
+		pointer->~T();
+		DeleteRaw(pointer);
+	}
+
+	//! освобождает ячейку без вызова деструктора
+	void DeleteRaw(T * pointer)
 	{
 		//find cell
 		//mark cell as free
 
-		UINT * bnum = (UINT*)((intptr_t)pointer - alignBy);
-		UINT blockID = *bnum;
-		UINT curPos = (UINT)((intptr_t)bnum - (intptr_t)memblocks[blockID].mem) / sizeof(MemCell);
-		--this->memblocks[blockID].used;
-		pointer->~T();
+		UINT blockID = LayoutImpl::FindBlock(pointer);
+		MemBlock * mb = &this->memblocks[blockID];
+		UINT curPos = LayoutImpl::FindCell(pointer, mb->mem);
+		assert(IsUsed(mb, curPos));
 
-		if(NumCurBlock > blockID)
-		{
-			NumCurBlock = blockID;
-		}
-		if(memblocks[blockID].pos > curPos)
-		{
-			*bnum = memblocks[blockID].pos | 0x80000000;
-			memblocks[blockID].pos = curPos;
-		}
-		else
+		if(mb->pos >= mb->size)
 		{
-			MemCell * mc = &(memblocks[blockID].mem[memblocks[blockID].pos]);
-			*bnum = mc->IsFree;
-			mc->IsFree = curPos | 0x80000000;
+			LinkFreeBlock(blockID);
 		}
+
+		mb->usedBits[curPos >> 5] &= ~(1u << (curPos & 31));
+		LayoutImpl::NextFree(mb->mem, curPos) = mb->pos;
+		mb->pos = curPos;
+		--mb->used;
+		MEMALLOC_STAT(m_stats.onFree());
 	}
 
 	void Delete(void * ptr)
@@ -367,46 +488,291 @@ public:
 	void GetMemUsage(UsageStats * us)
 	{
 		memset(us, 0, sizeof(UsageStats));
-		for(int i = 0; i < this->NumCurBlockCount; i++)
+		for(int i = 0; i < this->NumFilledBlocks; i++)
 		{
-			us->uAllocCount += this->memblocks[i].used;
-			us->uFreeCount += this->memblocks[i].size - this->memblocks[i].used;
+			if(this->memblocks[i].mem)
+			{
+				us->uAllocCount += this->memblocks[i].used;
+				us->uFreeCount += this->memblocks[i].size - this->memblocks[i].used;
+				us->ulSysMem += LayoutImpl::GetBlockBytes(this->memblocks[i].size);
+			}
 		}
 		us->ulAllocMem = us->uAllocCount * sizeof(T);
-		us->ulSysMem = (us->uAllocCount + us->uFreeCount) * sizeof(T) + NumCurBlockCount * sizeof(MemBlock);
+		us->ulSysMem += NumCurBlockCount * sizeof(MemBlock);
+	}
+
+	//! накопленная статистика пула, без MEMALLOC_STATS заполняется нулями
+	void GetStats(MemAllocStats * pStats) const
+	{
+#ifdef MEMALLOC_STATS
+		m_stats.getStats(pStats);
+#else
+		memset(pStats, 0, sizeof(MemAllocStats));
+#endif
 	}
 
+	//! имя пула в отчете MemAllocStatsNode::DumpReport
+	void setName(const char * szName)
+	{
+		MEMALLOC_STAT(m_stats.setName(szName));
+	}
+
+	//! освобождает полностью пустые блоки, кроме первого
 	void releaseEmptyPages()
 	{
-		int iPrevFreeBlock = 0;
-		for(int i = 1; i < this->NumCurBlockCount; ++i)
+		for(int i = 1; i < this->NumFilledBlocks; ++i)
 		{
-			if(this->memblocks[i].mem)
+			MemBlock * mb = &this->memblocks[i];
+			if(mb->mem && !mb->used)
 			{
-				bool isFree = true;
-				for(int j = 0; j < this->memblocks[i].size; j++)
+				UnlinkFreeBlock(i);
+				ReleaseBlock(i);
+			}
+		}
+	}
+
+	/*! Уплотняет пул: переносит объекты из блоков, заполненных не более чем на fMaxFill,
+		в более плотные блоки и освобождает опустевшие блоки (кроме первого).
+		Объект переносится перемещающим конструктором, после чего вызывается onRelocate(T *pOld, T *pNew)
+		и деструктор старого объекта. В onRelocate владелец должен исправить указатели на объект,
+		выделять и освобождать объекты этого пула в onRelocate нельзя.
+		Переносятся только объекты, для которых хватает места в остающихся блоках.
+		@return количество перенесенных объектов
+	*/
+	template<typename L>
+	UINT compact(const L &onRelocate, float fMaxFill = 0.5f)
+	{
+		// кандидаты - разреженные блоки, начиная с самых пустых
+		Array<int> aSources;
+		UINT uFreeCells = 0;
+		for(int i = 0; i < this->NumFilledBlocks; ++i)
+		{
+			MemBlock * mb = &this->memblocks[i];
+			if(!mb->mem)
+			{
+				continue;
+			}
+			uFreeCells += mb->size - mb->used;
+			if(i != 0 && mb->used && mb->used <= (UINT)(mb->size * fMaxFill))
+			{
+				aSources.push_back(i);
+			}
+		}
+		aSources.quickSort([this](int a, int b){
+			return(this->memblocks[a].used < this->memblocks[b].used);
+		});
+
+		// берем блоки, пока их объекты помещаются в свободные ячейки остальных блоков
+		UINT uSources = 0;
+		UINT uMoveCount = 0;
+		for(; uSources < aSources.size(); ++uSources)
+		{
+			MemBlock * mb = &this->memblocks[aSources[uSources]];
+			uFreeCells -= mb->size - mb->used;
+			if(uMoveCount + mb->used > uFreeCells)
+			{
+				break;
+			}
+			uMoveCount += mb->used;
+		}
+
+		for(UINT i = 0; i < uSources; ++i)
+		{
+			if(this->memblocks[aSources[i]].pos < this->memblocks[aSources[i]].size)
+			{
+				UnlinkFreeBlock(aSources[i]);
+			}
+		}
+
+		for(UINT i = 0; i < uSources; ++i)
+		{
+			int iBlock = aSources[i];
+			for(UINT j = 0, l = this->memblocks[iBlock].size; j < l; ++j)
+			{
+				if(IsUsed(&this->memblocks[iBlock], j))
 				{
-					if(!(this->memblocks[i].mem[j].IsFree & 0x80000000))
-					{
-						isFree = false;
-						break;
-					}
+					T * pOld = LayoutImpl::GetData(this->memblocks[iBlock].mem, j);
+					T * pNew = new(AllocRaw()) T(std::move(*pOld));
+					onRelocate(pOld, pNew);
+					pOld->~T();
+					MEMALLOC_STAT(m_stats.onFree());
 				}
-				if(isFree)
+			}
+			this->memblocks[iBlock].used = 0;
+			ReleaseBlock(iBlock);
+		}
+
+		return(uMoveCount);
+	}
+
+private:
+	//! см. ArrayParallel.h
+	template<typename P, typename L>
+	friend void MemAllocForEachParallel(P &pool, const L &fn, UINT uThreads);
+
+	template<typename L>
+	void ForEachInBlock(int iBlock, const L & fn)
+	{
+		const MemBlock * mb = &this->memblocks[iBlock];
+		if(!mb->used)
+		{
+			return;
+		}
+		for(UINT w = 0, l = (mb->size + 31) >> 5; w < l; ++w)
+		{
+			UINT uBits = mb->usedBits[w];
+			while(uBits)
+			{
+				fn(LayoutImpl::GetData(mb->mem, (w << 5) + MemAllocLowestBit(uBits)));
+				uBits &= uBits - 1;
+			}
+		}
+	}
+
+	//! освобождает память пустого блока, не связанного в список свободных, и переносит слот в список запасных
+	void ReleaseBlock(int iBlock)
+	{
+		MemBlock * mb = &this->memblocks[iBlock];
+		FreeBlockMem(iBlock);
+		memset(mb, 0, sizeof(MemBlock));
+
+		mb->nextFree = this->FirstSpareBlock;
+		this->FirstSpareBlock = iBlock;
+	}
+
+	static bool IsUsed(const MemBlock * mb, UINT uCell)
+	{
+		return((mb->usedBits[uCell >> 5] & (1u << (uCell & 31))) != 0);
+	}
+
+	void FillBlock(int iBlock, UINT size)
+	{
+		MemBlock * mb = &this->memblocks[iBlock];
+		mb->mem = (byte*)Allocator::Alloc(LayoutImpl::GetBlockBytes(size), LayoutImpl::BLOCK_ALIGN);
+		mb->size = size;
+		mb->used = 0;
+		MEMALLOC_STAT(m_stats.onGrow());
+		MEMALLOC_STAT(m_stats.onSysAlloc(LayoutImpl::GetBlockBytes(size)));
+		LayoutImpl::InitBlock(mb->mem, iBlock);
+		InitFreeList(iBlock);
+		LinkFreeBlock(iBlock);
+	}
+
+	void FreeBlockMem(int iBlock)
+	{
+		MEMALLOC_STAT(m_stats.onSysFree(LayoutImpl::GetBlockBytes(this->memblocks[iBlock].size)));
+		Allocator::Free(this->memblocks[iBlock].mem, LayoutImpl::GetBlockBytes(this->memblocks[iBlock].size));
+	}
+
+	static MemBlock* AllocBlockList(int iCount)
+	{
+		return((MemBlock*)Allocator::Alloc(sizeof(MemBlock) * iCount, alignof(MemBlock)));
+	}
+
+	static void FreeBlockList(MemBlock *pList, int iCount)
+	{
+		if(pList)
+		{
+			Allocator::Free(pList, sizeof(MemBlock) * iCount);
+		}
+	}
+
+	void InitFreeList(int iBlock)
+	{
+		MemBlock * mb = &this->memblocks[iBlock];
+		for(UINT i = 0; i < mb->size; i++)
+		{
+			LayoutImpl::NextFree(mb->mem, i) = i + 1;
+		}
+		memset(mb->usedBits, 0, sizeof(mb->usedBits));
+		mb->pos = 0;
+	}
+
+	void DestructBlock(int iBlock)
+	{
+		MemBlock * mb = &this->memblocks[iBlock];
+		if(mb->used)
+		{
+			for(UINT j = 0; j < mb->size; j++)
+			{
+				if(IsUsed(mb, j))
+				{
+					LayoutImpl::GetData(mb->mem, j)->~T();
+				}
+			}
+			MEMALLOC_STAT(m_stats.onFree(mb->used));
+			mb->used = 0;
+		}
+	}
+
+	void LinkFreeBlock(int iBlock)
+	{
+		MemBlock * mb = &this->memblocks[iBlock];
+		mb->prevFree = -1;
+		mb->nextFree = this->FirstFreeBlock;
+		if(this->FirstFreeBlock >= 0)
+		{
+			this->memblocks[this->FirstFreeBlock].prevFree = iBlock;
+		}
+		this->FirstFreeBlock = iBlock;
+	}
+
+	void UnlinkFreeBlock(int iBlock)
+	{
+		MemBlock * mb = &this->memblocks[iBlock];
+		if(mb->prevFree >= 0)
+		{
+			this->memblocks[mb->prevFree].nextFree = mb->nextFree;
+		}
+		else
+		{
+			this->FirstFreeBlock = mb->nextFree;
+		}
+		if(mb->nextFree >= 0)
+		{
+			this->memblocks[mb->nextFree].prevFree = mb->prevFree;
+		}
+		mb->nextFree = mb->prevFree = -1;
+	}
+
+	void CopyFrom(const MemAlloc & al)
+	{
+		if(!al.NumCurBlockCount)
+		{
+			return;
+		}
+		this->NumCurBlockCount = al.NumCurBlockCount;
+		this->NumFilledBlocks = al.NumFilledBlocks;
+		this->FirstFreeBlock = al.FirstFreeBlock;
+		this->FirstSpareBlock = al.FirstSpareBlock;
+		this->memblocks = AllocBlockList(this->NumCurBlockCount);
+		memcpy(this->memblocks, al.memblocks, this->NumCurBlockCount * sizeof(MemBlock));
+		MEMALLOC_STAT(m_stats.onSysAlloc(this->NumCurBlockCount * sizeof(MemBlock)));
+
+		for(int i = 0; i < this->NumFilledBlocks; i++)
+		{
+			const MemBlock * src = &al.memblocks[i];
+			MemBlock * mb = &this->memblocks[i];
+			if(!src->mem)
+			{
+				continue;
+			}
+
+			mb->mem = (byte*)Allocator::Alloc(LayoutImpl::GetBlockBytes(src->size), LayoutImpl::BLOCK_ALIGN);
+			MEMALLOC_STAT(m_stats.onGrow());
+			MEMALLOC_STAT(m_stats.onSysAlloc(LayoutImpl::GetBlockBytes(src->size)));
+			MEMALLOC_STAT(m_stats.onAlloc(src->used));
+			LayoutImpl::InitBlock(mb->mem, i);
+			for(UINT j = 0; j < src->size; j++)
+			{
+				if(IsUsed(src, j))
 				{
-					iPrevFreeBlock = i;
-					mem_free(this->memblocks[i].mem);
-					this->memblocks[i].mem = NULL;
+					LayoutImpl::MarkUsed(mb->mem, j, i);
+					new(LayoutImpl::GetData(mb->mem, j)) T(*LayoutImpl::GetData(src->mem, j));
 				}
-				else if(iPrevFreeBlock >= 0)
+				else
 				{
-					if(NumCurBlock == i)
-					{
-						NumCurBlock = iPrevFreeBlock;
-					}
-					this->memblocks[iPrevFreeBlock] = this->memblocks[i];
-					memset(&this->memblocks[i], 0, sizeof(this->memblocks[i]));
-					++iPrevFreeBlock;
+					LayoutImpl::NextFree(mb->mem, j) = LayoutImpl::NextFree(src->mem, j);
 				}
 			}
 		}
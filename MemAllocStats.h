@@ -0,0 +1,324 @@
+/******************************************************
+Copyright © Vitaliy Buturlin, Evgeny Danilovich, 2017
+See the license in LICENSE
+******************************************************/
+
+#ifndef __COMMON_MEMALLOC_STATS_H
+#define __COMMON_MEMALLOC_STATS_H
+
+#include "types.h"
+#include <stdio.h>
+
+/*! Инструментирование пулов MemAlloc.
+	Включается определением MEMALLOC_STATS до подключения MemAlloc.h, без него счетчики не компилируются.
+	Счетчики пула пишет только владеющий пулом поток (MemAlloc не потокобезопасен),
+	поэтому они обновляются relaxed load/store без атомарных RMW, а читать их можно из любого потока.
+	Пулы, в которые пишут несколько потоков (ConcurrentMemAlloc), используют onAllocShared/onFreeShared.
+	Определение MEMALLOC_STATS_CALLSITES дополнительно включает гистограмму мест выделения для MEMALLOC_ALLOC
+*/
+
+#ifdef MEMALLOC_STATS
+#	define MEMALLOC_STAT(expr) expr
+#else
+#	define MEMALLOC_STAT(expr)
+#endif
+
+//! снимок накопленной статистики пула
+struct MemAllocStats
+{
+	uint64_t ullAllocCount; // всего выделений
+	uint64_t ullFreeCount; // всего освобождений
+	uint64_t ullLiveCount; // живых объектов
+	uint64_t ullPeakLiveCount; // максимум живых объектов
+	uint64_t ullSysMem; // памяти получено у системы
+	uint64_t ullPeakSysMem; // максимум памяти, полученной у системы
+	uint64_t ullGrowCount; // количество выделений блоков
+};
+
+//! запись пула в реестре, хранит счетчики
+class MemAllocStatsNode
+{
+public:
+	MemAllocStatsNode(UINT uElemSize):
+		m_uElemSize(uElemSize)
+	{
+		Link();
+	}
+
+	MemAllocStatsNode(const MemAllocStatsNode &other):
+		m_szName(other.m_szName),
+		m_uElemSize(other.m_uElemSize)
+	{
+		Link();
+	}
+
+	//! счетчики не копируются, каждый пул ведет свои
+	MemAllocStatsNode& operator=(const MemAllocStatsNode&)
+	{
+		return(*this);
+	}
+
+	~MemAllocStatsNode()
+	{
+		Unlink();
+	}
+
+	void setName(const char *szName)
+	{
+		m_szName = szName;
+	}
+
+	const char* getName() const
+	{
+		return(m_szName);
+	}
+
+	UINT getElemSize() const
+	{
+		return(m_uElemSize);
+	}
+
+	void onAlloc(uint64_t ullCount = 1)
+	{
+		Add(m_counters.ullAllocCount, ullCount);
+		uint64_t ullLive = Add(m_counters.ullLiveCount, ullCount);
+		if(ullLive > Load(m_counters.ullPeakLiveCount))
+		{
+			Store(m_counters.ullPeakLiveCount, ullLive);
+		}
+	}
+
+	void onFree(uint64_t ullCount = 1)
+	{
+		Add(m_counters.ullFreeCount, ullCount);
+		Store(m_counters.ullLiveCount, Load(m_counters.ullLiveCount) - ullCount);
+	}
+
+	//! onAlloc для счетчиков, которые обновляют несколько потоков
+	void onAllocShared(uint64_t ullCount = 1)
+	{
+		m_counters.ullAllocCount.fetch_add(ullCount, std::memory_order_relaxed);
+		uint64_t ullLive = m_counters.ullLiveCount.fetch_add(ullCount, std::memory_order_relaxed) + ullCount;
+		uint64_t ullPeak = Load(m_counters.ullPeakLiveCount);
+		while(ullLive > ullPeak && !m_counters.ullPeakLiveCount.compare_exchange_weak(ullPeak, ullLive, std::memory_order_relaxed))
+		{
+		}
+	}
+
+	//! onFree для счетчиков, которые обновляют несколько потоков
+	void onFreeShared(uint64_t ullCount = 1)
+	{
+		m_counters.ullFreeCount.fetch_add(ullCount, std::memory_order_relaxed);
+		m_counters.ullLiveCount.fetch_sub(ullCount, std::memory_order_relaxed);
+	}
+
+	void onSysAlloc(size_t uBytes)
+	{
+		uint64_t ullSysMem = Add(m_counters.ullSysMem, uBytes);
+		if(ullSysMem > Load(m_counters.ullPeakSysMem))
+		{
+			Store(m_counters.ullPeakSysMem, ullSysMem);
+		}
+	}
+
+	void onSysFree(size_t uBytes)
+	{
+		Store(m_counters.ullSysMem, Load(m_counters.ullSysMem) - uBytes);
+	}
+
+	void onGrow()
+	{
+		Add(m_counters.ullGrowCount, 1);
+	}
+
+	void getStats(MemAllocStats *pStats) const
+	{
+		pStats->ullAllocCount = Load(m_counters.ullAllocCount);
+		pStats->ullFreeCount = Load(m_counters.ullFreeCount);
+		pStats->ullLiveCount = Load(m_counters.ullLiveCount);
+		pStats->ullPeakLiveCount = Load(m_counters.ullPeakLiveCount);
+		pStats->ullSysMem = Load(m_counters.ullSysMem);
+		pStats->ullPeakSysMem = Load(m_counters.ullPeakSysMem);
+		pStats->ullGrowCount = Load(m_counters.ullGrowCount);
+	}
+
+	/*! перебирает все живые пулы процесса
+		@note реестр заблокирован на время перебора, создавать и удалять пулы в pfnCallback нельзя
+	*/
+	template<typename L>
+	static void ForEach(const L &pfnCallback)
+	{
+		Registry &reg = GetRegistry();
+		ScopedSpinLock lock(reg.lock);
+		for(const MemAllocStatsNode *pNode = reg.pFirst; pNode; pNode = pNode->m_pNext)
+		{
+			pfnCallback(pNode);
+		}
+	}
+
+	//! выводит отчет по всем живым пулам
+	static void DumpReport(FILE *pOut = stdout)
+	{
+		fprintf(pOut, "%-32s %8s %12s %12s %12s %12s %14s %14s %8s\n", "pool", "elem", "allocs", "frees", "live", "peak live", "sys mem", "peak sys mem", "grows");
+
+		ForEach([pOut](const MemAllocStatsNode *pNode){
+			MemAllocStats stats;
+			pNode->getStats(&stats);
+			fprintf(pOut, "%-32s %8u %12llu %12llu %12llu %12llu %14llu %14llu %8llu\n", pNode->m_szName ? pNode->m_szName : "<unnamed>", pNode->m_uElemSize,
+				(unsigned long long)stats.ullAllocCount, (unsigned long long)stats.ullFreeCount, (unsigned long long)stats.ullLiveCount, (unsigned long long)stats.ullPeakLiveCount,
+				(unsigned long long)stats.ullSysMem, (unsigned long long)stats.ullPeakSysMem, (unsigned long long)stats.ullGrowCount);
+		});
+	}
+
+private:
+	struct Counters
+	{
+		std::atomic<uint64_t> ullAllocCount{0};
+		std::atomic<uint64_t> ullFreeCount{0};
+		std::atomic<uint64_t> ullLiveCount{0};
+		std::atomic<uint64_t> ullPeakLiveCount{0};
+		std::atomic<uint64_t> ullSysMem{0};
+		std::atomic<uint64_t> ullPeakSysMem{0};
+		std::atomic<uint64_t> ullGrowCount{0};
+	};
+
+	struct Registry
+	{
+		SpinLock lock;
+		MemAllocStatsNode *pFirst = NULL;
+	};
+
+	static Registry& GetRegistry()
+	{
+		static Registry s_registry;
+		return(s_registry);
+	}
+
+	static uint64_t Load(const std::atomic<uint64_t> &a)
+	{
+		return(a.load(std::memory_order_relaxed));
+	}
+
+	static void Store(std::atomic<uint64_t> &a, uint64_t ullValue)
+	{
+		a.store(ullValue, std::memory_order_relaxed);
+	}
+
+	static uint64_t Add(std::atomic<uint64_t> &a, uint64_t ullValue)
+	{
+		uint64_t ullNew = Load(a) + ullValue;
+		Store(a, ullNew);
+		return(ullNew);
+	}
+
+	void Link()
+	{
+		Registry &reg = GetRegistry();
+		ScopedSpinLock lock(reg.lock);
+		m_pPrev = NULL;
+		m_pNext = reg.pFirst;
+		if(reg.pFirst)
+		{
+			reg.pFirst->m_pPrev = this;
+		}
+		reg.pFirst = this;
+	}
+
+	void Unlink()
+	{
+		Registry &reg = GetRegistry();
+		ScopedSpinLock lock(reg.lock);
+		if(m_pPrev)
+		{
+			m_pPrev->m_pNext = m_pNext;
+		}
+		else
+		{
+			reg.pFirst = m_pNext;
+		}
+		if(m_pNext)
+		{
+			m_pNext->m_pPrev = m_pPrev;
+		}
+	}
+
+	const char *m_szName = NULL;
+	UINT m_uElemSize;
+	Counters m_counters;
+	MemAllocStatsNode *m_pPrev = NULL;
+	MemAllocStatsNode *m_pNext = NULL;
+};
+
+/*! Место выделения для гистограммы, создается статически в MEMALLOC_ALLOC.
+	Счетчики общие для всех потоков, поэтому обновляются атомарно
+*/
+class MemAllocCallsite
+{
+public:
+	MemAllocCallsite(const char *szFile, int iLine):
+		m_szFile(szFile),
+		m_iLine(iLine)
+	{
+		Registry &reg = GetRegistry();
+		ScopedSpinLock lock(reg.lock);
+		m_pNext = reg.pFirst;
+		reg.pFirst = this;
+	}
+
+	MemAllocCallsite(const MemAllocCallsite&) = delete;
+	MemAllocCallsite& operator=(const MemAllocCallsite&) = delete;
+
+	void onAlloc(size_t uBytes)
+	{
+		m_ullCount.fetch_add(1, std::memory_order_relaxed);
+		m_ullBytes.fetch_add(uBytes, std::memory_order_relaxed);
+	}
+
+	//! выводит количество и объем выделений по местам вызова
+	static void DumpReport(FILE *pOut = stdout)
+	{
+		Registry &reg = GetRegistry();
+		ScopedSpinLock lock(reg.lock);
+		fprintf(pOut, "%-48s %12s %14s\n", "callsite", "allocs", "bytes");
+		for(const MemAllocCallsite *pSite = reg.pFirst; pSite; pSite = pSite->m_pNext)
+		{
+			fprintf(pOut, "%-42s:%-5d %12llu %14llu\n", pSite->m_szFile, pSite->m_iLine,
+				(unsigned long long)pSite->m_ullCount.load(std::memory_order_relaxed), (unsigned long long)pSite->m_ullBytes.load(std::memory_order_relaxed));
+		}
+	}
+
+private:
+	struct Registry
+	{
+		SpinLock lock;
+		MemAllocCallsite *pFirst = NULL;
+	};
+
+	static Registry& GetRegistry()
+	{
+		static Registry s_registry;
+		return(s_registry);
+	}
+
+	const char *m_szFile;
+	int m_iLine;
+	std::atomic<uint64_t> m_ullCount{0};
+	std::atomic<uint64_t> m_ullBytes{0};
+	MemAllocCallsite *m_pNext;
+};
+
+/*! Выделение объекта из пула с учетом места вызова:
+	T *p = MEMALLOC_ALLOC(pool, args...);
+*/
+#ifdef MEMALLOC_STATS_CALLSITES
+#	define MEMALLOC_ALLOC(pool, ...) ([&](){ \
+		static MemAllocCallsite s_callsite(__FILE__, __LINE__); \
+		auto *pObj = (pool).Alloc(__VA_ARGS__); \
+		s_callsite.onAlloc(sizeof(*pObj)); \
+		return(pObj); \
+	}())
+#else
+#	define MEMALLOC_ALLOC(pool, ...) ((pool).Alloc(__VA_ARGS__))
+#endif
+
+#endif
@@ -0,0 +1,344 @@
+/******************************************************
+Copyright © Vitaliy Buturlin, Evgeny Danilovich, 2017
+See the license in LICENSE
+******************************************************/
+
+#ifndef __COMMON_MEMARENA_H
+#define __COMMON_MEMARENA_H
+
+#include "types.h"
+#include "Allocator.h"
+#include "array.h"
+#include <cstddef>
+
+/*! Линейная арена для короткоживущих временных данных.
+	Выделение - сдвиг указателя внутри текущего куска, освобождение - откат к метке или reset().
+	Куски памяти после отката не освобождаются, а используются повторно.
+	@note деструкторы объектов, созданных в арене, не вызываются
+*/
+class MemArena
+{
+	struct Chunk
+	{
+		Chunk *pNext;
+		size_t uSize;
+		size_t uUsed;
+	};
+
+public:
+	//! метка для отката арены
+	struct Marker
+	{
+		Chunk *pChunk;
+		size_t uUsed;
+	};
+
+	explicit MemArena(size_t uChunkSize = 64 * 1024):
+		m_uChunkSize(uChunkSize)
+	{
+	}
+
+	MemArena(const MemArena&) = delete;
+	MemArena& operator=(const MemArena&) = delete;
+
+	~MemArena()
+	{
+		release();
+	}
+
+	//! выделяет uSize байт с выравниванием uAlign
+	void* alloc(size_t uSize, size_t uAlign = alignof(std::max_align_t))
+	{
+		if(m_pCurrent)
+		{
+			void *pMem = allocInChunk(m_pCurrent, uSize, uAlign);
+			if(pMem)
+			{
+				return(pMem);
+			}
+
+			Chunk *pNext = m_pCurrent->pNext;
+			if(pNext && uSize + uAlign <= pNext->uSize)
+			{
+				pNext->uUsed = 0;
+				m_pCurrent = pNext;
+				return(allocInChunk(m_pCurrent, uSize, uAlign));
+			}
+		}
+
+		// крупные запросы получают кусок с запасом, чтобы последний блок мог расти на месте
+		Chunk *pChunk = newChunk(max(m_uChunkSize, (uSize + uAlign) * 2));
+		if(m_pCurrent)
+		{
+			pChunk->pNext = m_pCurrent->pNext;
+			m_pCurrent->pNext = pChunk;
+		}
+		else
+		{
+			pChunk->pNext = m_pFirst;
+			m_pFirst = pChunk;
+		}
+		m_pCurrent = pChunk;
+
+		return(allocInChunk(m_pCurrent, uSize, uAlign));
+	}
+
+	//! создает объект типа T в арене
+	template<typename T, typename... Args>
+	T* create(Args&&... args)
+	{
+		return(new(alloc(sizeof(T), alignof(T))) T(std::forward<Args>(args)...));
+	}
+
+	//! выделяет неинициализированный массив из uCount элементов типа T
+	template<typename T>
+	T* allocArray(size_t uCount)
+	{
+		return((T*)alloc(sizeof(T) * uCount, alignof(T)));
+	}
+
+	/*! пытается изменить размер последнего выделенного блока на месте
+		@return true, если pMem - последний выделенный блок и места в куске хватило
+	*/
+	bool resizeLast(void *pMem, size_t uOldSize, size_t uNewSize)
+	{
+		if(!isLast(pMem, uOldSize))
+		{
+			return(false);
+		}
+
+		size_t uOffset = (byte*)pMem - getChunkData(m_pCurrent);
+		if(uOffset + uNewSize > m_pCurrent->uSize)
+		{
+			return(false);
+		}
+
+		m_pCurrent->uUsed = uOffset + uNewSize;
+		return(true);
+	}
+
+	//! возвращает память, если pMem - последний выделенный блок, иначе ничего не делает
+	void freeLast(void *pMem, size_t uSize)
+	{
+		if(isLast(pMem, uSize))
+		{
+			m_pCurrent->uUsed = (byte*)pMem - getChunkData(m_pCurrent);
+		}
+	}
+
+	Marker getMarker() const
+	{
+		Marker marker = {m_pCurrent, m_pCurrent ? m_pCurrent->uUsed : 0};
+		return(marker);
+	}
+
+	//! откатывает арену к метке, все выделенное после нее считается свободным
+	void rewind(const Marker &marker)
+	{
+		m_pCurrent = marker.pChunk;
+		if(m_pCurrent)
+		{
+			m_pCurrent->uUsed = marker.uUsed;
+		}
+		else if(m_pFirst)
+		{
+			m_pCurrent = m_pFirst;
+			m_pCurrent->uUsed = 0;
+		}
+	}
+
+	//! откатывает арену в начало, память остается за ареной
+	void reset()
+	{
+		Marker marker = {NULL, 0};
+		rewind(marker);
+	}
+
+	//! освобождает всю память арены
+	void release()
+	{
+		while(m_pFirst)
+		{
+			Chunk *pNext = m_pFirst->pNext;
+			_aligned_free(m_pFirst);
+			m_pFirst = pNext;
+		}
+		m_pCurrent = NULL;
+	}
+
+	/*! лежит ли pMem в памяти, выделенной после метки текущей области видимости (см. MemArenaScope)
+		и еще не освобожденной откатом; без области видимости проверяется вся занятая часть арены
+	*/
+	bool isAllocatedInScope(const void *pMem) const
+	{
+		Chunk *pChunk = m_scopeMarker.pChunk ? m_scopeMarker.pChunk : m_pFirst;
+		size_t uFrom = m_scopeMarker.pChunk ? m_scopeMarker.uUsed : 0;
+		for(; pChunk; pChunk = pChunk->pNext)
+		{
+			byte *pData = getChunkData(pChunk);
+			if((const byte*)pMem >= pData + uFrom && (const byte*)pMem < pData + pChunk->uUsed)
+			{
+				return(true);
+			}
+			if(pChunk == m_pCurrent)
+			{
+				break;
+			}
+			uFrom = 0;
+		}
+		return(false);
+	}
+
+	//! устанавливает метку текущей области видимости, возвращает предыдущую
+	Marker setScopeMarker(const Marker &marker)
+	{
+		Marker prev = m_scopeMarker;
+		m_scopeMarker = marker;
+		return(prev);
+	}
+
+	//! объем памяти, полученный ареной у системы
+	size_t getReservedBytes() const
+	{
+		size_t uBytes = 0;
+		for(Chunk *pChunk = m_pFirst; pChunk; pChunk = pChunk->pNext)
+		{
+			uBytes += pChunk->uSize;
+		}
+		return(uBytes);
+	}
+
+	//! текущая арена потока, используется ArenaAllocator
+	static MemArena* GetCurrent()
+	{
+		return(CurrentSlot());
+	}
+
+	//! устанавливает текущую арену потока, возвращает предыдущую
+	static MemArena* SetCurrent(MemArena *pArena)
+	{
+		MemArena *pPrev = CurrentSlot();
+		CurrentSlot() = pArena;
+		return(pPrev);
+	}
+
+private:
+	static MemArena*& CurrentSlot()
+	{
+		static thread_local MemArena *s_pCurrent = NULL;
+		return(s_pCurrent);
+	}
+
+	static byte* getChunkData(Chunk *pChunk)
+	{
+		return((byte*)pChunk + MemAllocAlignUp(sizeof(Chunk), alignof(std::max_align_t)));
+	}
+
+	Chunk* newChunk(size_t uSize)
+	{
+		Chunk *pChunk = (Chunk*)_aligned_malloc(MemAllocAlignUp(sizeof(Chunk), alignof(std::max_align_t)) + uSize, alignof(std::max_align_t));
+		pChunk->pNext = NULL;
+		pChunk->uSize = uSize;
+		pChunk->uUsed = 0;
+		return(pChunk);
+	}
+
+	static void* allocInChunk(Chunk *pChunk, size_t uSize, size_t uAlign)
+	{
+		byte *pData = getChunkData(pChunk);
+		size_t uOffset = ((size_t)(pData + pChunk->uUsed) + uAlign - 1) / uAlign * uAlign - (size_t)pData;
+		if(uOffset + uSize > pChunk->uSize)
+		{
+			return(NULL);
+		}
+		pChunk->uUsed = uOffset + uSize;
+		return(pData + uOffset);
+	}
+
+	bool isLast(void *pMem, size_t uSize) const
+	{
+		return(m_pCurrent && (byte*)pMem + uSize == getChunkData(m_pCurrent) + m_pCurrent->uUsed);
+	}
+
+	size_t m_uChunkSize;
+	Chunk *m_pFirst = NULL;
+	Chunk *m_pCurrent = NULL;
+	Marker m_scopeMarker = {NULL, 0};
+};
+
+/*! Область видимости арены: запоминает метку и делает арену текущей для потока,
+	при выходе откатывает арену и восстанавливает предыдущую текущую арену.
+	Пример:
+	MemArena arena;
+	{
+		MemArenaScope scope(&arena);
+		ArenaArray<String> aTmp = ...;
+	}
+*/
+class MemArenaScope
+{
+public:
+	explicit MemArenaScope(MemArena *pArena):
+		m_pArena(pArena),
+		m_marker(pArena->getMarker()),
+		m_pPrevArena(MemArena::SetCurrent(pArena)),
+		m_prevScopeMarker(pArena->setScopeMarker(m_marker))
+	{
+	}
+
+	MemArenaScope(const MemArenaScope&) = delete;
+	MemArenaScope& operator=(const MemArenaScope&) = delete;
+
+	~MemArenaScope()
+	{
+		MemArena::SetCurrent(m_pPrevArena);
+		m_pArena->setScopeMarker(m_prevScopeMarker);
+		m_pArena->rewind(m_marker);
+	}
+
+private:
+	MemArena *m_pArena;
+	MemArena::Marker m_marker;
+	MemArena *m_pPrevArena;
+	MemArena::Marker m_prevScopeMarker;
+};
+
+/*! Стратегия выделения памяти из текущей арены потока (см. MemArenaScope).
+	Контейнер с такой стратегией должен быть уничтожен до отката арены и изменяться только
+	в той области видимости, где он создан: буфер, выросший во вложенной области, был бы освобожден
+	ее откатом. Free и Resize проверяют это утверждением
+*/
+struct ArenaAllocator
+{
+	static void* Alloc(size_t uSize, size_t uAlign)
+	{
+		MemArena *pArena = MemArena::GetCurrent();
+		assert(pArena);
+		return(pArena->alloc(uSize, uAlign));
+	}
+
+	static void Free(void *pMem, size_t uSize)
+	{
+		if(pMem)
+		{
+			MemArena *pArena = MemArena::GetCurrent();
+			assert(pArena && pArena->isAllocatedInScope(pMem));
+			if(pArena)
+			{
+				pArena->freeLast(pMem, uSize);
+			}
+		}
+	}
+
+	static bool Resize(void *pMem, size_t uOldSize, size_t uNewSize)
+	{
+		MemArena *pArena = MemArena::GetCurrent();
+		assert(!pMem || (pArena && pArena->isAllocatedInScope(pMem)));
+		return(pArena && pArena->resizeLast(pMem, uOldSize, uNewSize));
+	}
+};
+
+template<typename T, int BlockSize = 16>
+using ArenaArray = Array<T, BlockSize, true, ArenaAllocator>;
+
+#endif
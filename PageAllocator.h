@@ -0,0 +1,342 @@
+/******************************************************
+Copyright © Vitaliy Buturlin, Evgeny Danilovich, 2017
+See the license in LICENSE
+******************************************************/
+
+#ifndef __COMMON_PAGE_ALLOCATOR_H
+#define __COMMON_PAGE_ALLOCATOR_H
+
+#include "types.h"
+#include "Allocator.h"
+#include "array.h"
+
+#if defined(_WINDOWS)
+#	include <windows.h>
+#else
+#	include <sys/mman.h>
+#endif
+
+//! размер резервируемого диапазона адресов
+#define PAGE_ALLOCATOR_REGION_BYTES (64 * 1024 * 1024)
+//! размер большой страницы
+#define PAGE_ALLOCATOR_HUGE_PAGE_BYTES (2 * 1024 * 1024)
+//! количество корзин свободных диапазонов по степени двойки размера
+#define PAGE_ALLOCATOR_BIN_COUNT (sizeof(size_t) * 8)
+
+/*! Стратегия выделения памяти (см. Allocator.h) из больших диапазонов адресов, полученных mmap/VirtualAlloc.
+	Диапазоны выравниваются на большую страницу и помечаются MADV_HUGEPAGE, что уменьшает промахи TLB
+	у пулов из миллионов объектов.
+	Освобожденная память не возвращается в кучу: физические страницы отдаются системе через MADV_DONTNEED
+	(MEM_RESET на Windows), а адреса сохраняются в упорядоченном списке свободных диапазонов.
+	Соседние свободные диапазоны сливаются, диапазон у границы выделенной части текущего региона
+	возвращается в регион, при выделении подходящий диапазон делится.
+	Запросы больше PAGE_ALLOCATOR_REGION_BYTES / 4 получают отдельное отображение, которое освобождается сразу.
+	@note выделение и освобождение потокобезопасны
+*/
+struct PageAllocator
+{
+	static void* Alloc(size_t uSize, size_t uAlign)
+	{
+		uSize = MemAllocAlignUp(uSize, sizeof(void*));
+		if(uSize > PAGE_ALLOCATOR_REGION_BYTES / 4)
+		{
+			return(MapRange(uSize, max(uAlign, (size_t)PAGE_ALLOCATOR_HUGE_PAGE_BYTES)));
+		}
+
+		State &state = GetState();
+		ScopedSpinLock lock(state.lock);
+
+		void *pMem = AllocFromFreeRanges(state, uSize, uAlign);
+		if(pMem)
+		{
+			return(pMem);
+		}
+
+		size_t uOffset = MemAllocAlignUp(state.uRegionUsed, uAlign);
+		if(!state.pRegion || uOffset + uSize > PAGE_ALLOCATOR_REGION_BYTES)
+		{
+			byte *pRegion = (byte*)MapRange(PAGE_ALLOCATOR_REGION_BYTES, PAGE_ALLOCATOR_HUGE_PAGE_BYTES);
+			if(!pRegion)
+			{
+				return(NULL);
+			}
+			if(state.pRegion)
+			{
+				// остаток старого региона уходит в свободные диапазоны
+				AddFreeRange(state, state.pRegion + state.uRegionUsed, PAGE_ALLOCATOR_REGION_BYTES - state.uRegionUsed);
+			}
+			state.pRegion = pRegion;
+			state.uRegionUsed = 0;
+			uOffset = 0;
+		}
+
+		AddFreeRange(state, state.pRegion + state.uRegionUsed, uOffset - state.uRegionUsed);
+		state.uRegionUsed = uOffset + uSize;
+		return(state.pRegion + uOffset);
+	}
+
+	static void Free(void *pMem, size_t uSize)
+	{
+		if(!pMem)
+		{
+			return;
+		}
+
+		uSize = MemAllocAlignUp(uSize, sizeof(void*));
+		if(uSize > PAGE_ALLOCATOR_REGION_BYTES / 4)
+		{
+			UnmapRange(pMem, uSize);
+			return;
+		}
+
+		DiscardRange(pMem, uSize);
+
+		State &state = GetState();
+		ScopedSpinLock lock(state.lock);
+		AddFreeRange(state, (byte*)pMem, uSize);
+	}
+
+	static bool Resize(void*, size_t, size_t)
+	{
+		return(false);
+	}
+
+private:
+	struct FreeRange
+	{
+		byte *pMem;
+		size_t uSize;
+	};
+
+	struct State
+	{
+		SpinLock lock;
+		byte *pRegion = NULL;
+		size_t uRegionUsed = 0;
+		//! свободные диапазоны по возрастанию адреса, соседние всегда слиты
+		Array<FreeRange> aFreeRanges;
+		//! количество свободных диапазонов в каждой корзине GetBin
+		UINT aBinCount[PAGE_ALLOCATOR_BIN_COUNT] = {};
+	};
+
+	static State& GetState()
+	{
+		static State s_state;
+		return(s_state);
+	}
+
+	//! номер корзины: старший установленный бит размера
+	static UINT GetBin(size_t uSize)
+	{
+		UINT uBin = 0;
+		while(uSize >>= 1)
+		{
+			++uBin;
+		}
+		return(uBin);
+	}
+
+	static void InsertFreeRange(State &state, UINT uIndex, byte *pMem, size_t uSize)
+	{
+		FreeRange range = {pMem, uSize};
+		state.aFreeRanges.insert(range, uIndex);
+		++state.aBinCount[GetBin(uSize)];
+	}
+
+	static void RemoveFreeRange(State &state, UINT uIndex)
+	{
+		--state.aBinCount[GetBin(state.aFreeRanges[uIndex].uSize)];
+		state.aFreeRanges.erase(uIndex);
+	}
+
+	//! индекс первого свободного диапазона, начинающегося после pMem
+	static UINT FindFreeRange(const State &state, const byte *pMem)
+	{
+		UINT uLo = 0, uHi = state.aFreeRanges.size();
+		while(uLo < uHi)
+		{
+			UINT uMid = (uLo + uHi) / 2;
+			if(state.aFreeRanges[uMid].pMem <= pMem)
+			{
+				uLo = uMid + 1;
+			}
+			else
+			{
+				uHi = uMid;
+			}
+		}
+		return(uLo);
+	}
+
+	//! добавляет диапазон в список, сливая с соседями, и возвращает в регион, если он примыкает к его границе
+	static void AddFreeRange(State &state, byte *pMem, size_t uSize)
+	{
+		if(!uSize)
+		{
+			return;
+		}
+
+		byte *pEnd = pMem + uSize;
+		UINT uIndex = FindFreeRange(state, pMem);
+		if(uIndex > 0)
+		{
+			const FreeRange &prev = state.aFreeRanges[uIndex - 1];
+			if(prev.pMem + prev.uSize == pMem)
+			{
+				pMem = prev.pMem;
+				RemoveFreeRange(state, --uIndex);
+			}
+		}
+		if(uIndex < state.aFreeRanges.size() && state.aFreeRanges[uIndex].pMem == pEnd)
+		{
+			pEnd += state.aFreeRanges[uIndex].uSize;
+			RemoveFreeRange(state, uIndex);
+		}
+
+		if(state.pRegion && pEnd == state.pRegion + state.uRegionUsed)
+		{
+			byte *pStart = max(pMem, state.pRegion);
+			state.uRegionUsed = pStart - state.pRegion;
+			pEnd = pStart;
+		}
+
+		if(pEnd != pMem)
+		{
+			InsertFreeRange(state, uIndex, pMem, pEnd - pMem);
+		}
+	}
+
+	//! выделяет память из наименьшего подходящего свободного диапазона, остатки остаются в списке
+	static void* AllocFromFreeRanges(State &state, size_t uSize, size_t uAlign)
+	{
+		UINT uBin = GetBin(uSize);
+		while(uBin < PAGE_ALLOCATOR_BIN_COUNT && !state.aBinCount[uBin])
+		{
+			++uBin;
+		}
+		if(uBin == PAGE_ALLOCATOR_BIN_COUNT)
+		{
+			return(NULL);
+		}
+
+		int iBest = -1;
+		for(UINT i = 0, l = state.aFreeRanges.size(); i < l; ++i)
+		{
+			const FreeRange &range = state.aFreeRanges[i];
+			byte *pAligned = (byte*)MemAllocAlignUp((size_t)range.pMem, uAlign);
+			if(pAligned + uSize <= range.pMem + range.uSize && (iBest < 0 || range.uSize < state.aFreeRanges[iBest].uSize))
+			{
+				iBest = (int)i;
+				if(range.uSize == uSize)
+				{
+					break;
+				}
+			}
+		}
+		if(iBest < 0)
+		{
+			return(NULL);
+		}
+
+		FreeRange range = state.aFreeRanges[iBest];
+		byte *pAligned = (byte*)MemAllocAlignUp((size_t)range.pMem, uAlign);
+		byte *pEnd = pAligned + uSize;
+		UINT uIndex = (UINT)iBest;
+		RemoveFreeRange(state, uIndex);
+		if(pAligned != range.pMem)
+		{
+			InsertFreeRange(state, uIndex++, range.pMem, pAligned - range.pMem);
+		}
+		if(pEnd != range.pMem + range.uSize)
+		{
+			InsertFreeRange(state, uIndex, pEnd, range.pMem + range.uSize - pEnd);
+		}
+		return(pAligned);
+	}
+
+	static size_t GetPageSize()
+	{
+#if defined(_WINDOWS)
+		SYSTEM_INFO si;
+		GetSystemInfo(&si);
+		return(si.dwPageSize);
+#else
+		return((size_t)sysconf(_SC_PAGESIZE));
+#endif
+	}
+
+	//! отображает uSize байт с выравниванием uAlign, лишнее по краям возвращается системе
+	static void* MapRange(size_t uSize, size_t uAlign)
+	{
+		size_t uPageSize = GetPageSize();
+		uSize = MemAllocAlignUp(uSize, uPageSize);
+		uAlign = max(uAlign, uPageSize);
+
+#if defined(_WINDOWS)
+		// VirtualAlloc выравнивает на 64 КБ, для большего выравнивания резервируем с запасом и перерезервируем
+		for(;;)
+		{
+			byte *pReserved = (byte*)VirtualAlloc(NULL, uSize + uAlign, MEM_RESERVE, PAGE_NOACCESS);
+			if(!pReserved)
+			{
+				return(NULL);
+			}
+			byte *pAligned = (byte*)MemAllocAlignUp((size_t)pReserved, uAlign);
+			VirtualFree(pReserved, 0, MEM_RELEASE);
+			void *pMem = VirtualAlloc(pAligned, uSize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+			if(pMem)
+			{
+				return(pMem);
+			}
+		}
+#else
+		byte *pReserved = (byte*)mmap(NULL, uSize + uAlign, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if(pReserved == MAP_FAILED)
+		{
+			return(NULL);
+		}
+		byte *pAligned = (byte*)MemAllocAlignUp((size_t)pReserved, uAlign);
+		if(pAligned != pReserved)
+		{
+			munmap(pReserved, pAligned - pReserved);
+		}
+		size_t uTail = (pReserved + uSize + uAlign) - (pAligned + uSize);
+		if(uTail)
+		{
+			munmap(pAligned + uSize, uTail);
+		}
+#	ifdef MADV_HUGEPAGE
+		madvise(pAligned, uSize, MADV_HUGEPAGE);
+#	endif
+		return(pAligned);
+#endif
+	}
+
+	static void UnmapRange(void *pMem, size_t uSize)
+	{
+#if defined(_WINDOWS)
+		VirtualFree(pMem, 0, MEM_RELEASE);
+#else
+		munmap(pMem, MemAllocAlignUp(uSize, GetPageSize()));
+#endif
+	}
+
+	//! отдает системе физические страницы, целиком лежащие внутри диапазона
+	static void DiscardRange(void *pMem, size_t uSize)
+	{
+		size_t uPageSize = GetPageSize();
+		size_t uStart = MemAllocAlignUp((size_t)pMem, uPageSize);
+		size_t uEnd = ((size_t)pMem + uSize) / uPageSize * uPageSize;
+		if(uEnd <= uStart)
+		{
+			return;
+		}
+#if defined(_WINDOWS)
+		VirtualAlloc((void*)uStart, uEnd - uStart, MEM_RESET, PAGE_READWRITE);
+#else
+		madvise((void*)uStart, uEnd - uStart, MADV_DONTNEED);
+#endif
+	}
+};
+
+#endif
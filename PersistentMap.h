@@ -0,0 +1,513 @@
+/******************************************************
+Copyright © Vitaliy Buturlin, Evgeny Danilovich, 2017
+See the license in LICENSE
+******************************************************/
+
+#ifndef __COMMON_PERSISTENT_MAP_H
+#define __COMMON_PERSISTENT_MAP_H
+
+#include <common/ConcurrentMemAlloc.h>
+#include <common/hash.h>
+#include <memory>
+
+//! предельная высота дерева PersistentMap, АВЛ-дерево из 2^32 элементов ниже 47 уровней
+#define PERSISTENT_MAP_MAX_HEIGHT 48
+
+template<typename K, typename V>
+class PersistentMap;
+
+/*! Неизменяемый снимок PersistentMap, создается и копируется за O(1).
+	Снимок разделяет узлы с массивом и другими снимками, поэтому занимает память только под узлы,
+	измененные после его создания. Читать снимок можно из любого потока без блокировок,
+	в том числе пока массив изменяется, и уничтожать тоже можно в любом потоке.
+	Один объект снимка не должен одновременно изменяться (присваиваться) и читаться разными потоками.
+*/
+template<typename K, typename V>
+class PersistentMapSnapshot
+{
+	friend class PersistentMap<K, V>;
+
+protected:
+	/*! узел дерева, узел с uRefs > 1 может быть доступен из снимков и не изменяется,
+		на месте изменяются только узлы с единственной ссылкой
+	*/
+	struct Node
+	{
+		Node *pLeft;
+		Node *pRight;
+		std::atomic<UINT> uRefs;
+		UINT uHeight;
+		K Key;
+		V Val;
+
+		template<typename... Args>
+		Node(const K &key, Args&&... args):
+			pLeft(NULL),
+			pRight(NULL),
+			uRefs(1),
+			uHeight(1),
+			Key(key),
+			Val(args...)
+		{
+		}
+
+		//! копия узла ссылается на тех же потомков, ссылки на них добавляет вызывающий
+		Node(const Node &other):
+			pLeft(other.pLeft),
+			pRight(other.pRight),
+			uRefs(1),
+			uHeight(other.uHeight),
+			Key(other.Key),
+			Val(other.Val)
+		{
+		}
+	};
+
+	//! пул узлов, общий для массива и всех его снимков, живет, пока жив хотя бы один из них
+	struct Pool
+	{
+		ConcurrentMemAlloc<Node> nodes;
+
+		static void AddRef(Node *pNode)
+		{
+			if(pNode)
+			{
+				pNode->uRefs.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+
+		void release(Node *pNode)
+		{
+			while(pNode && pNode->uRefs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			{
+				Node *pRight = pNode->pRight;
+				release(pNode->pLeft);
+				nodes.Delete(pNode);
+				pNode = pRight;
+			}
+		}
+	};
+
+public:
+	class Iterator
+	{
+	public:
+		const K *first;
+		const V *second;
+
+		Iterator(const Node *pRoot = NULL):
+			m_uDepth(0)
+		{
+			PushLeft(pRoot);
+			Update();
+		}
+
+		bool operator==(const Iterator &c) const
+		{
+			return(c.Top() == Top());
+		}
+
+		bool operator!=(const Iterator &c) const
+		{
+			return(c.Top() != Top());
+		}
+
+		operator bool() const
+		{
+			return(m_uDepth != 0);
+		}
+
+		Iterator& operator++()
+		{
+			if(m_uDepth)
+			{
+				const Node *pNode = m_apStack[--m_uDepth];
+				PushLeft(pNode->pRight);
+				Update();
+			}
+			return(*this);
+		}
+
+		Iterator operator++(int)
+		{
+			Iterator it = *this;
+			++(*this);
+			return(it);
+		}
+
+	private:
+		const Node* Top() const
+		{
+			return(m_uDepth ? m_apStack[m_uDepth - 1] : NULL);
+		}
+
+		void PushLeft(const Node *pNode)
+		{
+			for(; pNode; pNode = pNode->pLeft)
+			{
+				assert(m_uDepth < PERSISTENT_MAP_MAX_HEIGHT);
+				m_apStack[m_uDepth++] = pNode;
+			}
+		}
+
+		void Update()
+		{
+			const Node *pNode = Top();
+			first = pNode ? &pNode->Key : NULL;
+			second = pNode ? &pNode->Val : NULL;
+		}
+
+		const Node *m_apStack[PERSISTENT_MAP_MAX_HEIGHT];
+		UINT m_uDepth;
+	};
+
+	PersistentMapSnapshot():
+		m_pPool(std::make_shared<Pool>())
+	{
+	}
+
+	PersistentMapSnapshot(const PersistentMapSnapshot &other):
+		m_pPool(other.m_pPool),
+		m_pRoot(other.m_pRoot),
+		m_uSize(other.m_uSize)
+	{
+		Pool::AddRef(m_pRoot);
+	}
+
+	~PersistentMapSnapshot()
+	{
+		m_pPool->release(m_pRoot);
+	}
+
+	PersistentMapSnapshot& operator=(const PersistentMapSnapshot &other)
+	{
+		Pool::AddRef(other.m_pRoot);
+		m_pPool->release(m_pRoot);
+		m_pPool = other.m_pPool;
+		m_pRoot = other.m_pRoot;
+		m_uSize = other.m_uSize;
+		return(*this);
+	}
+
+	//! R, если ключи K можно искать по O без создания временного K (см. XIsTransparentKey)
+	template<typename O, typename R>
+	using IfTransparentKey = typename std::enable_if<XIsTransparentKey<K, typename std::decay<O>::type>::value, R>::type;
+
+	bool KeyExists(const K &key) const
+	{
+		return(Find(key) != NULL);
+	}
+
+	template<typename O>
+	IfTransparentKey<O, bool> KeyExists(const O &key) const
+	{
+		return(Find(key) != NULL);
+	}
+
+	const V* at(const K &key) const
+	{
+		return(At(key));
+	}
+
+	template<typename O>
+	IfTransparentKey<O, const V*> at(const O &key) const
+	{
+		return(At(key));
+	}
+
+	const V& operator[](const K &key) const
+	{
+		const V *pVal = At(key);
+		assert(pVal);
+		return(*pVal);
+	}
+
+	template<typename O>
+	IfTransparentKey<O, const V&> operator[](const O &key) const
+	{
+		const V *pVal = At(key);
+		assert(pVal);
+		return(*pVal);
+	}
+
+	unsigned int Size() const
+	{
+		return(m_uSize);
+	}
+
+	Iterator begin() const
+	{
+		return(Iterator(m_pRoot));
+	}
+
+	Iterator end() const
+	{
+		return(Iterator());
+	}
+
+protected:
+	template<typename O>
+	const Node* Find(const O &key) const
+	{
+		const Node *pNode = m_pRoot;
+		while(pNode)
+		{
+			if(pNode->Key == key)
+			{
+				return(pNode);
+			}
+			pNode = pNode->Key < key ? pNode->pRight : pNode->pLeft;
+		}
+		return(NULL);
+	}
+
+	template<typename O>
+	const V* At(const O &key) const
+	{
+		const Node *pNode = Find(key);
+		return(pNode ? &pNode->Val : NULL);
+	}
+
+	std::shared_ptr<Pool> m_pPool;
+	Node *m_pRoot = NULL;
+	UINT m_uSize = 0;
+};
+
+/*! Персистентный упорядоченный ассоциативный массив: АВЛ-дерево с копированием пути.
+	snapshot() за O(1) возвращает неизменяемый снимок текущего состояния (см. PersistentMapSnapshot),
+	копирование массива тоже стоит O(1). Изменение копирует только узлы на пути от корня,
+	которые разделены со снимками, узлы с единственной ссылкой изменяются на месте,
+	поэтому без живых снимков массив работает как обычное дерево.
+	Время жизни узлов определяется счетчиками ссылок, память берется из общего пула ConcurrentMemAlloc,
+	поэтому последний владелец узла может освободить его в любом потоке.
+	В отличие от AssotiativeArray используется АВЛ-балансировка: удаление в ней проще переносится на копирование пути.
+	@note K и V должны быть копируемыми, K - иметь operator< и operator==
+	@note изменять массив может только один поток
+*/
+template<typename K, typename V>
+class PersistentMap: public PersistentMapSnapshot<K, V>
+{
+	typedef PersistentMapSnapshot<K, V> BaseType;
+	typedef typename BaseType::Node Node;
+	typedef typename BaseType::Pool Pool;
+
+public:
+	typedef PersistentMapSnapshot<K, V> Snapshot;
+
+	PersistentMap() = default;
+
+	PersistentMap(const PersistentMap &other) = default;
+
+	PersistentMap& operator=(const PersistentMap &other) = default;
+
+	//! снимок текущего состояния
+	Snapshot snapshot() const
+	{
+		return(*this);
+	}
+
+	/*! значение по ключу, при отсутствии ключ добавляется.
+		Путь к узлу перед этим отделяется от снимков, поэтому изменение значения их не затрагивает.
+		Ссылка действительна до следующего изменения массива или создания снимка
+	*/
+	V& operator[](const K &key)
+	{
+		V *pVal = NULL;
+		this->m_pRoot = Insert(this->m_pRoot, key, &pVal);
+		return(*pVal);
+	}
+
+	//! добавляет ключ со значением, сконструированным из args, существующее значение не изменяется
+	template<typename... Args>
+	const V* insert(const K &key, Args&&... args)
+	{
+		const Node *pNode = this->Find(key);
+		if(pNode)
+		{
+			return(&pNode->Val);
+		}
+		V *pVal = NULL;
+		this->m_pRoot = Insert(this->m_pRoot, key, &pVal, args...);
+		return(pVal);
+	}
+
+	void erase(const K &key)
+	{
+		EraseKey(key);
+	}
+
+	template<typename O>
+	typename PersistentMapSnapshot<K, V>::template IfTransparentKey<O, void> erase(const O &key)
+	{
+		EraseKey(key);
+	}
+
+	void clear()
+	{
+		this->m_pPool->release(this->m_pRoot);
+		this->m_pRoot = NULL;
+		this->m_uSize = 0;
+	}
+
+private:
+	template<typename O>
+	void EraseKey(const O &key)
+	{
+		// путь копируется, только если ключ действительно есть
+		if(this->Find(key))
+		{
+			this->m_pRoot = Erase(this->m_pRoot, key);
+			--this->m_uSize;
+		}
+	}
+
+	static UINT GetHeight(const Node *pNode)
+	{
+		return(pNode ? pNode->uHeight : 0);
+	}
+
+	static void UpdateHeight(Node *pNode)
+	{
+		UINT uLeft = GetHeight(pNode->pLeft);
+		UINT uRight = GetHeight(pNode->pRight);
+		pNode->uHeight = (uLeft > uRight ? uLeft : uRight) + 1;
+	}
+
+	/*! принимает ссылку вызывающего на узел и возвращает узел, которым вызывающий владеет единолично:
+		сам узел, если других ссылок нет, иначе его копию
+	*/
+	Node* MakeUnique(Node *pNode)
+	{
+		if(pNode->uRefs.load(std::memory_order_acquire) == 1)
+		{
+			return(pNode);
+		}
+		Node *pCopy = this->m_pPool->nodes.Alloc(*pNode);
+		Pool::AddRef(pCopy->pLeft);
+		Pool::AddRef(pCopy->pRight);
+		this->m_pPool->release(pNode);
+		return(pCopy);
+	}
+
+	//! повороты и балансировка работают только с узлами, которыми владеет вызывающий
+	Node* RotateLeft(Node *pNode)
+	{
+		Node *pRight = MakeUnique(pNode->pRight);
+		pNode->pRight = pRight->pLeft;
+		pRight->pLeft = pNode;
+		UpdateHeight(pNode);
+		UpdateHeight(pRight);
+		return(pRight);
+	}
+
+	Node* RotateRight(Node *pNode)
+	{
+		Node *pLeft = MakeUnique(pNode->pLeft);
+		pNode->pLeft = pLeft->pRight;
+		pLeft->pRight = pNode;
+		UpdateHeight(pNode);
+		UpdateHeight(pLeft);
+		return(pLeft);
+	}
+
+	Node* Balance(Node *pNode)
+	{
+		UpdateHeight(pNode);
+		int iBalance = (int)GetHeight(pNode->pLeft) - (int)GetHeight(pNode->pRight);
+		if(iBalance > 1)
+		{
+			if(GetHeight(pNode->pLeft->pLeft) < GetHeight(pNode->pLeft->pRight))
+			{
+				pNode->pLeft = RotateLeft(MakeUnique(pNode->pLeft));
+			}
+			return(RotateRight(pNode));
+		}
+		if(iBalance < -1)
+		{
+			if(GetHeight(pNode->pRight->pRight) < GetHeight(pNode->pRight->pLeft))
+			{
+				pNode->pRight = RotateRight(MakeUnique(pNode->pRight));
+			}
+			return(RotateLeft(pNode));
+		}
+		return(pNode);
+	}
+
+	template<typename... Args>
+	Node* Insert(Node *pNode, const K &key, V **ppVal, Args&&... args)
+	{
+		if(!pNode)
+		{
+			Node *pNew = this->m_pPool->nodes.Alloc(key, args...);
+			*ppVal = &pNew->Val;
+			++this->m_uSize;
+			return(pNew);
+		}
+
+		pNode = MakeUnique(pNode);
+		if(key < pNode->Key)
+		{
+			pNode->pLeft = Insert(pNode->pLeft, key, ppVal, args...);
+		}
+		else if(pNode->Key < key)
+		{
+			pNode->pRight = Insert(pNode->pRight, key, ppVal, args...);
+		}
+		else
+		{
+			*ppVal = &pNode->Val;
+			return(pNode);
+		}
+		return(Balance(pNode));
+	}
+
+	//! отделяет узел с наименьшим ключом, возвращает новый корень поддерева
+	Node* EraseMin(Node *pNode, Node **ppMin)
+	{
+		pNode = MakeUnique(pNode);
+		if(!pNode->pLeft)
+		{
+			*ppMin = pNode;
+			Node *pRight = pNode->pRight;
+			pNode->pRight = NULL;
+			return(pRight);
+		}
+		pNode->pLeft = EraseMin(pNode->pLeft, ppMin);
+		return(Balance(pNode));
+	}
+
+	template<typename O>
+	Node* Erase(Node *pNode, const O &key)
+	{
+		assert(pNode);
+		pNode = MakeUnique(pNode);
+		if(pNode->Key == key)
+		{
+			if(!pNode->pLeft || !pNode->pRight)
+			{
+				Node *pChild = pNode->pLeft ? pNode->pLeft : pNode->pRight;
+				pNode->pLeft = pNode->pRight = NULL;
+				this->m_pPool->release(pNode);
+				return(pChild);
+			}
+
+			// узел с двумя потомками занимает наименьший элемент правого поддерева
+			Node *pMin = NULL;
+			pNode->pRight = EraseMin(pNode->pRight, &pMin);
+			pNode->Key = std::move(pMin->Key);
+			pNode->Val = std::move(pMin->Val);
+			this->m_pPool->release(pMin);
+		}
+		else if(pNode->Key < key)
+		{
+			pNode->pRight = Erase(pNode->pRight, key);
+		}
+		else
+		{
+			pNode->pLeft = Erase(pNode->pLeft, key);
+		}
+		return(Balance(pNode));
+	}
+};
+
+#endif
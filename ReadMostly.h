@@ -0,0 +1,136 @@
+/******************************************************
+Copyright © Vitaliy Buturlin, Evgeny Danilovich, 2017
+See the license in LICENSE
+******************************************************/
+
+#ifndef __COMMON_READ_MOSTLY_H
+#define __COMMON_READ_MOSTLY_H
+
+#include <common/ConcurrentMemAlloc.h>
+#include <thread>
+
+//! количество счетчиков читателей, потоки распределяются по ним по номеру MemAllocThreadSlot
+#define READ_MOSTLY_READER_SLOTS 64
+
+/*! Обертка для редко изменяемых объектов с чтением без блокировок (схема Left-Right).
+	Объект хранится в двух копиях: читатели работают с одной из них, писатель изменяет другую,
+	затем переключает читателей на нее, дожидается выхода читателей из старой копии и повторяет изменение в ней.
+	Чтение не ждет ни писателя, ни других читателей и стоит двух атомарных операций над счетчиком своего потока,
+	запись выполняется дважды и ждет завершения начатых чтений, писатели выполняются по очереди.
+	Пример для ассоциативного массива:
+		ReadMostly<AssotiativeArray<String, int>> map;
+		map.write([&](AssotiativeArray<String, int> &m){
+			m[szName] = iValue;
+		});
+		int iValue = 0;
+		map.read([&](const AssotiativeArray<String, int> &m){
+			const int *pValue = m.at(szName);
+			if(pValue)
+			{
+				iValue = *pValue;
+			}
+		});
+	@note функция записи вызывается для каждой копии и должна изменять их одинаково
+	@note указатели внутрь объекта нельзя выносить за пределы функции чтения
+	@note функция чтения может вызывать только константные методы T, которые не изменяют общее состояние
+*/
+template<typename T>
+class ReadMostly
+{
+public:
+	template<typename... Args>
+	ReadMostly(Args&&... args):
+		m_aInstances{T(args...), T(args...)}
+	{
+	}
+
+	ReadMostly(const ReadMostly&) = delete;
+	ReadMostly& operator=(const ReadMostly&) = delete;
+
+	//! вызывает fn(const T&) без блокировок, возвращает ее результат
+	template<typename L>
+	auto read(const L &fn) const -> decltype(fn(std::declval<const T&>()))
+	{
+		ReadGuard guard(this);
+		return(fn(m_aInstances[m_iReadInstance.load()]));
+	}
+
+	//! вызывает fn(T&) для обеих копий, возвращает результат второго вызова
+	template<typename L>
+	auto write(const L &fn) -> decltype(fn(std::declval<T&>()))
+	{
+		std::lock_guard<std::mutex> lock(m_writeMutex);
+
+		int iReadInstance = m_iReadInstance.load();
+		fn(m_aInstances[1 - iReadInstance]);
+		m_iReadInstance.store(1 - iReadInstance);
+
+		// новые читатели уже видят обновленную копию, ждем выхода тех, кто мог начать чтение старой
+		int iIndicator = m_iIndicator.load();
+		WaitForReaders(1 - iIndicator);
+		m_iIndicator.store(1 - iIndicator);
+		WaitForReaders(iIndicator);
+
+		return(fn(m_aInstances[iReadInstance]));
+	}
+
+private:
+	XALIGNED(struct, 64) ReaderSlot
+	{
+		std::atomic<int> iCount{0};
+	};
+
+	//! счетчики читателей одного поколения
+	struct ReadIndicator
+	{
+		ReaderSlot aSlots[READ_MOSTLY_READER_SLOTS];
+
+		bool isEmpty() const
+		{
+			for(UINT i = 0; i < READ_MOSTLY_READER_SLOTS; ++i)
+			{
+				if(aSlots[i].iCount.load())
+				{
+					return(false);
+				}
+			}
+			return(true);
+		}
+	};
+
+	class ReadGuard
+	{
+	public:
+		ReadGuard(const ReadMostly *pOwner):
+			m_pSlot(&pOwner->m_aIndicators[pOwner->m_iIndicator.load()].aSlots[MemAllocThreadSlot::Get() % READ_MOSTLY_READER_SLOTS])
+		{
+			m_pSlot->iCount.fetch_add(1);
+		}
+
+		~ReadGuard()
+		{
+			m_pSlot->iCount.fetch_sub(1);
+		}
+
+	private:
+		ReaderSlot *m_pSlot;
+	};
+
+	void WaitForReaders(int iIndicator) const
+	{
+		while(!m_aIndicators[iIndicator].isEmpty())
+		{
+			std::this_thread::yield();
+		}
+	}
+
+	T m_aInstances[2];
+	//! копия, с которой работают читатели
+	std::atomic<int> m_iReadInstance{0};
+	//! поколение счетчиков, в котором отмечаются новые читатели
+	std::atomic<int> m_iIndicator{0};
+	mutable ReadIndicator m_aIndicators[2];
+	std::mutex m_writeMutex;
+};
+
+#endif
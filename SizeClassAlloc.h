@@ -0,0 +1,232 @@
+/******************************************************
+Copyright © Vitaliy Buturlin, Evgeny Danilovich, 2017
+See the license in LICENSE
+******************************************************/
+
+#ifndef __SIZE_CLASS_ALLOC_H
+#define __SIZE_CLASS_ALLOC_H
+
+#include <common/MemAlloc.h>
+
+//! размер и выравнивание куска памяти, общие для всех классов SizeClassAlloc
+#define SIZE_CLASS_CHUNK_BYTES (64 * 1024)
+
+//! классы размеров SizeClassAlloc: X(номер, размер ячейки)
+#define SIZE_CLASS_LIST(X) \
+	X(0, 16)   X(1, 32)   X(2, 48)   X(3, 64)    \
+	X(4, 96)   X(5, 128)  X(6, 192)  X(7, 256)   \
+	X(8, 384)  X(9, 512)  X(10, 768) X(11, 1024) \
+	X(12, 1536) X(13, 2048) X(14, 3072) X(15, 4096)
+
+#define SIZE_CLASS_COUNT 16
+#define SIZE_CLASS_MAX_SIZE 4096
+
+/*! Аллокатор объектов произвольного размера на основе пулов MemAlloc.
+	Запросы до SIZE_CLASS_MAX_SIZE байт обслуживаются пулом ближайшего большего класса.
+	Куски пулов выровнены на SIZE_CLASS_CHUNK_BYTES и начинаются с MemAllocPackedLayout::ChunkHeader,
+	в uTag которого записан размер ячейки класса, поэтому Free не требует размера.
+	Пул класса выделяет первый кусок только при первом запросе этого класса.
+	Более крупные блоки Alloc выделяет отдельным куском с тем же выравниванием и uTag == LARGE_TAG,
+	поэтому Free освобождает любой блок без размера.
+	AllocLarge/FreeLarge - явный путь для заведомо крупных блоков без выравнивания на кусок,
+	такие блоки освобождаются только FreeLarge.
+	Вся выдаваемая память выровнена на 16 байт.
+	@note не потокобезопасен
+*/
+template <typename Allocator = HeapAllocator>
+class SizeClassAlloc
+{
+	template <UINT uSize>
+	struct Cell
+	{
+		byte data[uSize];
+	};
+
+	//! ячеек в блоке так, чтобы блок занимал ровно SIZE_CLASS_CHUNK_BYTES
+	template <UINT uSize>
+	struct ClassPool
+	{
+		static const int BLOCK_CELLS = (SIZE_CLASS_CHUNK_BYTES - 16) / uSize;
+
+		typedef MemAlloc<Cell<uSize>, BLOCK_CELLS, 16, 16, MemAllocPackedLayout<uSize>, Allocator> Pool;
+
+		static_assert(MemAllocPackedLayout<uSize>::template Impl<Cell<uSize>, BLOCK_CELLS, 16>::CHUNK_BYTES == SIZE_CLASS_CHUNK_BYTES, "Unexpected size class chunk size");
+	};
+
+	typedef MemAllocPackedLayout<>::ChunkHeader ChunkHeader;
+
+	//! заголовок крупного блока, лежит непосредственно перед данными, hdr.uTag == LARGE_TAG
+	struct LargeHeader
+	{
+		ChunkHeader hdr;
+		size_t uSize;
+	};
+
+	static const UINT LARGE_TAG = 0;
+	static const size_t LARGE_HEADER_SIZE = MemAllocAlignUp(sizeof(LargeHeader), 16);
+
+public:
+	SizeClassAlloc()
+	{
+		for(UINT i = 0, uClass = 0; i < sizeof(m_aClassBySize); ++i)
+		{
+			while(GetClassSize(uClass) < i * 16)
+			{
+				++uClass;
+			}
+			m_aClassBySize[i] = (byte)uClass;
+		}
+	}
+
+	SizeClassAlloc(const SizeClassAlloc&) = delete;
+	SizeClassAlloc& operator=(const SizeClassAlloc&) = delete;
+
+	//! выделяет uSize байт
+	void* Alloc(size_t uSize)
+	{
+		if(uSize > SIZE_CLASS_MAX_SIZE)
+		{
+			return(AllocLargeBlock(uSize, SIZE_CLASS_CHUNK_BYTES));
+		}
+
+		switch(m_aClassBySize[(uSize + 15) / 16])
+		{
+#define SIZE_CLASS_ALLOC(idx, size) case idx: return(m_pool##idx.AllocRaw());
+			SIZE_CLASS_LIST(SIZE_CLASS_ALLOC)
+#undef SIZE_CLASS_ALLOC
+		}
+
+		assert(!"Invalid size class");
+		return(NULL);
+	}
+
+	//! освобождает память, выделенную Alloc
+	void Free(void *pMem)
+	{
+		if(!pMem)
+		{
+			return;
+		}
+
+		const ChunkHeader *pHeader = MemAllocPackedLayout<>::GetChunkHeader<SIZE_CLASS_CHUNK_BYTES>(pMem);
+		switch(pHeader->uTag)
+		{
+		case LARGE_TAG:
+			FreeLarge(pMem);
+			return;
+#define SIZE_CLASS_FREE(idx, size) case size: m_pool##idx.DeleteRaw((Cell<size>*)pMem); return;
+			SIZE_CLASS_LIST(SIZE_CLASS_FREE)
+#undef SIZE_CLASS_FREE
+		}
+
+		assert(!"Invalid pointer");
+	}
+
+	//! выделяет крупный блок из uSize байт без выравнивания на кусок, освобождается только FreeLarge
+	void* AllocLarge(size_t uSize)
+	{
+		return(AllocLargeBlock(uSize, 16));
+	}
+
+	//! освобождает память, выделенную AllocLarge или Alloc с размером больше SIZE_CLASS_MAX_SIZE
+	void FreeLarge(void *pMem)
+	{
+		if(!pMem)
+		{
+			return;
+		}
+
+		LargeHeader *pLarge = GetLargeHeader(pMem);
+		Allocator::Free(pLarge, LARGE_HEADER_SIZE + pLarge->uSize);
+	}
+
+	//! размер блока, фактически выделенного Alloc под pMem
+	size_t GetAllocSize(const void *pMem) const
+	{
+		const ChunkHeader *pHeader = MemAllocPackedLayout<>::GetChunkHeader<SIZE_CLASS_CHUNK_BYTES>(pMem);
+		if(pHeader->uTag == LARGE_TAG)
+		{
+			return(GetLargeSize(pMem));
+		}
+		return(pHeader->uTag);
+	}
+
+	//! размер крупного блока (AllocLarge или Alloc с размером больше SIZE_CLASS_MAX_SIZE)
+	static size_t GetLargeSize(const void *pMem)
+	{
+		return(GetLargeHeader(pMem)->uSize);
+	}
+
+	static UINT GetClassCount()
+	{
+		return(SIZE_CLASS_COUNT);
+	}
+
+	static UINT GetClassSize(UINT uClass)
+	{
+		switch(uClass)
+		{
+#define SIZE_CLASS_SIZE(idx, size) case idx: return(size);
+			SIZE_CLASS_LIST(SIZE_CLASS_SIZE)
+#undef SIZE_CLASS_SIZE
+		}
+		return(0);
+	}
+
+	//! статистика пула класса uClass
+	void GetMemUsage(UINT uClass, UsageStats *us)
+	{
+		switch(uClass)
+		{
+#define SIZE_CLASS_USAGE(idx, size) case idx: m_pool##idx.GetMemUsage(us); return;
+			SIZE_CLASS_LIST(SIZE_CLASS_USAGE)
+#undef SIZE_CLASS_USAGE
+		}
+		memset(us, 0, sizeof(UsageStats));
+	}
+
+	//! суммарная статистика по всем классам, крупные блоки не учитываются
+	void GetMemUsage(UsageStats *us)
+	{
+		memset(us, 0, sizeof(UsageStats));
+		for(UINT i = 0; i < SIZE_CLASS_COUNT; ++i)
+		{
+			UsageStats classUsage;
+			GetMemUsage(i, &classUsage);
+			us->uAllocCount += classUsage.uAllocCount;
+			us->uFreeCount += classUsage.uFreeCount;
+			us->ulSysMem += classUsage.ulSysMem;
+			us->ulAllocMem += classUsage.ulAllocMem;
+		}
+	}
+
+	void releaseEmptyPages()
+	{
+#define SIZE_CLASS_RELEASE(idx, size) m_pool##idx.releaseEmptyPages();
+		SIZE_CLASS_LIST(SIZE_CLASS_RELEASE)
+#undef SIZE_CLASS_RELEASE
+	}
+
+private:
+	void* AllocLargeBlock(size_t uSize, size_t uAlign)
+	{
+		LargeHeader *pLarge = (LargeHeader*)Allocator::Alloc(LARGE_HEADER_SIZE + uSize, uAlign);
+		pLarge->hdr.uBlockID = 0;
+		pLarge->hdr.uTag = LARGE_TAG;
+		pLarge->uSize = uSize;
+		return((byte*)pLarge + LARGE_HEADER_SIZE);
+	}
+
+	static LargeHeader* GetLargeHeader(const void *pMem)
+	{
+		return((LargeHeader*)((byte*)pMem - LARGE_HEADER_SIZE));
+	}
+
+#define SIZE_CLASS_POOL(idx, size) typename ClassPool<size>::Pool m_pool##idx;
+	SIZE_CLASS_LIST(SIZE_CLASS_POOL)
+#undef SIZE_CLASS_POOL
+
+	byte m_aClassBySize[SIZE_CLASS_MAX_SIZE / 16 + 1];
+};
+
+#endif
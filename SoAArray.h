@@ -0,0 +1,311 @@
+/******************************************************
+Copyright © Vitaliy Buturlin, Evgeny Danilovich, 2017
+See the license in LICENSE
+******************************************************/
+
+#ifndef __COMMON_SOA_ARRAY_H
+#define __COMMON_SOA_ARRAY_H
+
+#include "types.h"
+#include "Allocator.h"
+#include "array.h"
+#include "math.h"
+#ifdef __AVX__
+#	include <immintrin.h>
+#endif
+
+//! выравнивание столбцов SoAArray, достаточное для загрузки 8 float одной инструкцией
+#define SOA_ARRAY_ALIGN 32
+//! объем столбцов кратен этому числу элементов
+#define SOA_ARRAY_LANES 8
+
+/*! Массив структур, разложенный по столбцам (structure of arrays): каждое из uColumns полей
+	хранится в отдельном непрерывном столбце, выровненном на SOA_ARRAY_ALIGN.
+	Например, SoAArray<float, 3> хранит точки как столбцы x, y, z.
+	Пакетные методы loadBatch4/storeBatch4 (и loadBatch8/storeBatch8 при __AVX__) читают и пишут
+	по 4 (8) соседних элемента каждого столбца в SMVECTOR (__m256) для обработки в регистрах.
+	Пакеты могут выходить за size() в пределах объема столбцов, значения таких элементов задает fillPadding().
+	Удаление переносит последний элемент на место удаленного, порядок элементов не сохраняется.
+	@note T должен быть тривиально копируемым
+*/
+template<typename T, UINT uColumns, typename Allocator = HeapAllocator>
+class SoAArray
+{
+	static_assert(std::is_trivially_copyable<T>::value, "SoAArray requires trivially copyable T");
+	static_assert(uColumns > 0, "SoAArray requires at least one column");
+
+public:
+	//! 4 соседних элемента каждого столбца
+	struct Batch4
+	{
+		SMVECTOR v[uColumns];
+	};
+
+#ifdef __AVX__
+	//! 8 соседних элементов каждого столбца
+	struct Batch8
+	{
+		__m256 v[uColumns];
+	};
+#endif
+
+	SoAArray() = default;
+
+	SoAArray(const SoAArray &other)
+	{
+		*this = other;
+	}
+
+	SoAArray(SoAArray &&other)
+	{
+		swap(other);
+	}
+
+	~SoAArray()
+	{
+		clear();
+	}
+
+	SoAArray& operator=(const SoAArray &other)
+	{
+		if(&other != this)
+		{
+			m_uSize = 0;
+			reserve(other.m_uSize);
+			if(other.m_uSize)
+			{
+				for(UINT i = 0; i < uColumns; ++i)
+				{
+					memcpy(getColumn(i), other.getColumn(i), sizeof(T) * other.m_uSize);
+				}
+			}
+			m_uSize = other.m_uSize;
+		}
+		return(*this);
+	}
+
+	SoAArray& operator=(SoAArray &&other)
+	{
+		if(&other != this)
+		{
+			clear();
+			swap(other);
+		}
+		return(*this);
+	}
+
+	void swap(SoAArray &other)
+	{
+		std::swap(m_pData, other.m_pData);
+		std::swap(m_uSize, other.m_uSize);
+		std::swap(m_uAllocSize, other.m_uAllocSize);
+	}
+
+	UINT size() const
+	{
+		return(m_uSize);
+	}
+
+	//! объем каждого столбца, кратен SOA_ARRAY_LANES
+	UINT capacity() const
+	{
+		return(m_uAllocSize);
+	}
+
+	void reserve(UINT uSize)
+	{
+		if(uSize > m_uAllocSize)
+		{
+			Realloc(uSize);
+		}
+	}
+
+	void resize(UINT uSize)
+	{
+		Grow(uSize);
+		m_uSize = uSize;
+	}
+
+	T* getColumn(UINT uColumn)
+	{
+		assert(uColumn < uColumns);
+		return(m_pData + uColumn * m_uAllocSize);
+	}
+
+	const T* getColumn(UINT uColumn) const
+	{
+		assert(uColumn < uColumns);
+		return(m_pData + uColumn * m_uAllocSize);
+	}
+
+	T& get(UINT uColumn, UINT uIndex)
+	{
+		assert(uIndex < m_uSize);
+		return(getColumn(uColumn)[uIndex]);
+	}
+
+	const T& get(UINT uColumn, UINT uIndex) const
+	{
+		assert(uIndex < m_uSize);
+		return(getColumn(uColumn)[uIndex]);
+	}
+
+	//! добавляет элемент со значениями столбцов values, возвращает его индекс
+	template<typename... Args>
+	UINT push_back(Args... values)
+	{
+		static_assert(sizeof...(Args) == uColumns, "SoAArray::push_back requires a value for each column");
+
+		Grow(m_uSize + 1);
+		T aValues[] = {(T)values...};
+		for(UINT i = 0; i < uColumns; ++i)
+		{
+			getColumn(i)[m_uSize] = aValues[i];
+		}
+		return(m_uSize++);
+	}
+
+	//! удаляет элемент, перенося на его место последний
+	void erase_swap(UINT uIndex)
+	{
+		assert(uIndex < m_uSize);
+
+		--m_uSize;
+		if(uIndex != m_uSize)
+		{
+			for(UINT i = 0; i < uColumns; ++i)
+			{
+				T *pColumn = getColumn(i);
+				pColumn[uIndex] = pColumn[m_uSize];
+			}
+		}
+	}
+
+	void clearFast()
+	{
+		m_uSize = 0;
+	}
+
+	void clear()
+	{
+		if(m_pData)
+		{
+			Allocator::Free(m_pData, GetBytes(m_uAllocSize));
+		}
+		m_pData = NULL;
+		m_uSize = 0;
+		m_uAllocSize = 0;
+	}
+
+	/*! заполняет элементы от size() до границы пакета из uLanes элементов копией последнего элемента,
+		чтобы пакетная обработка хвоста не влияла на min/max и подобные свертки
+	*/
+	void fillPadding(UINT uLanes = SOA_ARRAY_LANES)
+	{
+		if(!m_uSize)
+		{
+			return;
+		}
+		UINT uEnd = (UINT)MemAllocAlignUp(m_uSize, uLanes);
+		for(UINT i = 0; i < uColumns; ++i)
+		{
+			T *pColumn = getColumn(i);
+			for(UINT j = m_uSize; j < uEnd; ++j)
+			{
+				pColumn[j] = pColumn[m_uSize - 1];
+			}
+		}
+	}
+
+	//! количество пакетов по 4 элемента, последний может быть неполным
+	UINT getBatch4Count() const
+	{
+		return((m_uSize + 3) / 4);
+	}
+
+	void loadBatch4(UINT uBatch, Batch4 *pBatch) const
+	{
+		static_assert(std::is_same<T, float>::value, "SoAArray batches require float columns");
+		for(UINT i = 0; i < uColumns; ++i)
+		{
+			pBatch->v[i].mmv = _mm_load_ps(getColumn(i) + uBatch * 4);
+		}
+	}
+
+	void storeBatch4(UINT uBatch, const Batch4 &batch)
+	{
+		static_assert(std::is_same<T, float>::value, "SoAArray batches require float columns");
+		for(UINT i = 0; i < uColumns; ++i)
+		{
+			_mm_store_ps(getColumn(i) + uBatch * 4, batch.v[i].mmv);
+		}
+	}
+
+#ifdef __AVX__
+	//! количество пакетов по 8 элементов, последний может быть неполным
+	UINT getBatch8Count() const
+	{
+		return((m_uSize + 7) / 8);
+	}
+
+	void loadBatch8(UINT uBatch, Batch8 *pBatch) const
+	{
+		static_assert(std::is_same<T, float>::value, "SoAArray batches require float columns");
+		for(UINT i = 0; i < uColumns; ++i)
+		{
+			pBatch->v[i] = _mm256_load_ps(getColumn(i) + uBatch * 8);
+		}
+	}
+
+	void storeBatch8(UINT uBatch, const Batch8 &batch)
+	{
+		static_assert(std::is_same<T, float>::value, "SoAArray batches require float columns");
+		for(UINT i = 0; i < uColumns; ++i)
+		{
+			_mm256_store_ps(getColumn(i) + uBatch * 8, batch.v[i]);
+		}
+	}
+#endif
+
+private:
+	static size_t GetBytes(UINT uAllocSize)
+	{
+		return(sizeof(T) * uAllocSize * uColumns);
+	}
+
+	void Grow(UINT uSize)
+	{
+		if(uSize > m_uAllocSize)
+		{
+			Realloc(ArrayGrowGeometric::GetCapacity(m_uAllocSize, uSize, SOA_ARRAY_LANES));
+		}
+	}
+
+	void Realloc(UINT uAllocSize)
+	{
+		// столбцы начинаются на границе SOA_ARRAY_ALIGN
+		uAllocSize = (UINT)MemAllocAlignUp(uAllocSize, max((size_t)SOA_ARRAY_LANES, SOA_ARRAY_ALIGN / sizeof(T)));
+
+		T *pData = (T*)Allocator::Alloc(GetBytes(uAllocSize), SOA_ARRAY_ALIGN);
+		assert(pData);
+		if(m_pData)
+		{
+			for(UINT i = 0; i < uColumns; ++i)
+			{
+				memcpy(pData + i * uAllocSize, m_pData + i * m_uAllocSize, sizeof(T) * m_uSize);
+			}
+			Allocator::Free(m_pData, GetBytes(m_uAllocSize));
+		}
+		m_pData = pData;
+		m_uAllocSize = uAllocSize;
+	}
+
+	T *m_pData = NULL;
+	UINT m_uSize = 0;
+	UINT m_uAllocSize = 0;
+};
+
+typedef SoAArray<float, 3> SoAFloat3;
+typedef SoAArray<float, 4> SoAFloat4;
+
+#endif
@@ -8,21 +8,123 @@ See the license in LICENSE
 #define Array_H
 
 #include <new>
+#include <utility>
+#include <type_traits>
+#if defined(__SSE__) || defined(_M_X64)
+#	include <xmmintrin.h>
+#endif
 #include "types.h"
+#include "Allocator.h"
 
 /*
 	внимание:
 		Элемент массива не имеет гарантированного расположения в памяти.
+	Allocator - стратегия выделения памяти под элементы (см. Allocator.h)
+	Growth - стратегия роста (ArrayGrowGeometric, ArrayGrowFixed)
+	InlineCount - количество элементов, хранящихся внутри самого массива без выделения памяти (см. SmallArray)
+	При определенном ARRAY_STATS массив считает свои перевыделения памяти (getReallocCount),
+	макрос должен быть одинаковым во всем проекте
+*/
+
+/*! Признак того, что объект T можно переместить в памяти побайтовым копированием
+	без вызова конструктора перемещения и деструктора.
+	По умолчанию выполняется для тривиально копируемых типов, для остальных может быть специализирован,
+	например, для классов, владеющих памятью через указатель и не хранящих указателей на себя
+*/
+template<typename T>
+struct ArrayIsRelocatable: std::integral_constant<bool, std::is_trivially_copyable<T>::value>
+{
+};
+
+//! диапазоны не длиннее этого сортируются вставками
+#define ARRAY_INSERTION_SORT_THRESHOLD 16
+
+/*! Непрерывный диапазон элементов без владения памятью и без проверок границ.
+	Размер и указатель хранятся по значению, поэтому в циклах вида fora(i, view) компилятор
+	не перечитывает их на каждой итерации и может векторизовать цикл
+*/
+template<typename T>
+struct ArrayView
+{
+	T *pData;
+	UINT uSize;
+
+	UINT size() const
+	{
+		return(uSize);
+	}
+
+	T& operator[](UINT key) const
+	{
+		return(pData[key]);
+	}
+
+	T* begin() const
+	{
+		return(pData);
+	}
+
+	T* end() const
+	{
+		return(pData + uSize);
+	}
+};
+
+/*! Стратегии роста массива: GetCapacity возвращает новый объем для uRequired элементов
+	при текущем объеме uAllocSize. Возвращаемое значение не меньше uRequired
 */
 
+//! рост в 1.5 раза, но не меньше чем на BlockSize элементов; используется по умолчанию
+struct ArrayGrowGeometric
+{
+	static UINT GetCapacity(UINT uAllocSize, UINT uRequired, UINT uBlockSize)
+	{
+		UINT uCapacity = max(uAllocSize + uAllocSize / 2, uAllocSize + uBlockSize);
+		return(max(uCapacity, uRequired));
+	}
+};
+
+//! рост фиксированными шагами по BlockSize элементов, для экономии памяти
+struct ArrayGrowFixed
+{
+	static UINT GetCapacity(UINT uAllocSize, UINT uRequired, UINT uBlockSize)
+	{
+		return(max(uAllocSize, uRequired - 1) + uBlockSize);
+	}
+};
+
+//! встроенное хранилище на uCount элементов для Array с InlineCount > 0
+template<typename T, UINT uCount>
+class ArrayInlineStorage
+{
+protected:
+	T* GetInlineData()
+	{
+		return((T*)m_inlineData);
+	}
+
+private:
+	alignas(T) byte m_inlineData[sizeof(T) * uCount];
+};
+
+template<typename T>
+class ArrayInlineStorage<T, 0>
+{
+protected:
+	T* GetInlineData()
+	{
+		return(NULL);
+	}
+};
+
 /*#ifdef S4G
 template <typename T, int BlockSize = 16>
 class s4g_Stack;
 
 #endif*/
 
-template<typename T, int BlockSize=16, bool fully_defined=true>
-class Array
+template<typename T, int BlockSize=16, bool fully_defined=true, typename Allocator=HeapAllocator, typename Growth=ArrayGrowGeometric, UINT InlineCount=0>
+class Array: private ArrayInlineStorage<T, InlineCount>
 {
 private:
 #ifdef _MSC_VER
@@ -66,16 +168,27 @@ public:
 	Array(const Array &arr)
 	{
 		Realloc(arr.Size);
-		//this->AllocSize = arr.AllocSize;
-		//this->Size = arr.Size;
-		for(UINT i = 0; i < arr.Size; ++i)
-		{
-			(*this)[i] = arr[i];
-		}
+		CopyInterval(this->Data, arr.Data, arr.Size);
+		this->Size = arr.Size;
+	}
+
+	Array(Array &&arr)
+	{
+		swap(arr);
 	}
 
 	void swap(Array &arr)
 	{
+		if(IsInline() || arr.IsInline())
+		{
+			// встроенные элементы нельзя обменять указателем
+			Array tmp;
+			tmp.TakeFrom(*this);
+			TakeFrom(arr);
+			arr.TakeFrom(tmp);
+			return;
+		}
+
 		UINT tmpS = Size;
 		Size = arr.Size;
 		arr.Size = tmpS;
@@ -95,7 +208,14 @@ public:
 		{
 			return;
 		}
-		Realloc(NewSize);
+		if(NewSize > this->Size)
+		{
+			Grow(NewSize);
+		}
+		else
+		{
+			Realloc(NewSize);
+		}
 		//ConstructInterval(this->Size, key);
 		if(this->Size < NewSize)
 		{
@@ -136,7 +256,30 @@ public:
 
 	void push_back(const T & data)
 	{
-		(*this)[this->Size] = data;
+		emplace_back(data);
+	}
+
+	void push_back(T && data)
+	{
+		emplace_back(std::move(data));
+	}
+
+	//! создает элемент в конце массива из аргументов args
+	template<typename... Args>
+	T& emplace_back(Args&&... args)
+	{
+		if(this->Size == this->AllocSize)
+		{
+			// args могут ссылаться на элементы массива, которые станут недействительными после перевыделения
+			T tmp(std::forward<Args>(args)...);
+			Grow(this->Size + 1);
+			new(&this->Data[this->Size]) T(std::move(tmp));
+		}
+		else
+		{
+			new(&this->Data[this->Size]) T(std::forward<Args>(args)...);
+		}
+		return(this->Data[this->Size++]);
 	}
 
 	void erase(UINT key)
@@ -145,11 +288,7 @@ public:
 
 		if(key < this->Size)
 		{
-			(&this->Data[key])->~T();
-			if(key < this->Size - 1)
-			{
-				memcpy(&this->Data[key], &this->Data[key + 1], sizeof(T)* (this->Size - key - 1));
-			}
+			EraseShift(key, ArrayIsRelocatable<T>());
 			this->Size--;
 		}
 	}
@@ -165,18 +304,30 @@ public:
 	//	return(*this);
 	//}
 
-	Array& operator=(const Array<T, BlockSize> & arr)
+	Array& operator=(const Array & arr)
 	{
-		//this->AllocSize = arr.AllocSize;
-		//this->Size = arr.Size;
+		if(&arr == this)
+		{
+			return(*this);
+		}
 		if(arr.Size < this->Size)
 		{
 			DestructInterval(arr.Size, this->Size - 1);
 			this->Size = arr.Size;
 		}
-		for(int i = arr.Size - 1; i >= 0; i--)
+		reserve(arr.Size);
+		AssignInterval(this->Data, arr.Data, this->Size, std::is_trivially_copyable<T>());
+		CopyInterval(this->Data + this->Size, arr.Data + this->Size, arr.Size - this->Size);
+		this->Size = arr.Size;
+		return(*this);
+	}
+
+	Array& operator=(Array && arr)
+	{
+		if(&arr != this)
 		{
-			(*this)[i] = arr[i];
+			clear();
+			swap(arr);
 		}
 		return(*this);
 	}
@@ -202,10 +353,7 @@ public:
 		UINT key = (UINT)_key;
 		if(key >= this->Size)
 		{
-			if(key >= this->AllocSize)
-			{
-				Realloc(max(this->AllocSize, key) + BlockSize);
-			}
+			Grow(key + 1);
 			ConstructInterval(this->Size, key);
 			this->Size = key + 1;
 		}
@@ -213,11 +361,73 @@ public:
 	}
 
 
+	//! доступ без проверки границ и без роста массива
 	T& GetKeyOC(UINT key)
 	{
 		return(Data[key]);
 	}
 
+	const T& GetKeyOC(UINT key) const
+	{
+		return(Data[key]);
+	}
+
+	//! доступ к существующему элементу, массив не растет, выход за границы проверяется assert
+	T& at(UINT key)
+	{
+		assert(key < this->Size);
+		return(Data[key]);
+	}
+
+	const T& at(UINT key) const
+	{
+		assert(key < this->Size);
+		return(Data[key]);
+	}
+
+	T* data()
+	{
+		return(Data);
+	}
+
+	const T* data() const
+	{
+		return(Data);
+	}
+
+	T* begin()
+	{
+		return(Data);
+	}
+
+	T* end()
+	{
+		return(Data + Size);
+	}
+
+	const T* begin() const
+	{
+		return(Data);
+	}
+
+	const T* end() const
+	{
+		return(Data + Size);
+	}
+
+	//! представление элементов для горячих циклов, действительно до изменения размера массива
+	ArrayView<T> view()
+	{
+		ArrayView<T> v = {Data, Size};
+		return(v);
+	}
+
+	ArrayView<const T> view() const
+	{
+		ArrayView<const T> v = {Data, Size};
+		return(v);
+	}
+
 	void SetKeyOC(UINT key, T& val)
 	{
 		Data[key] = val;
@@ -239,7 +449,7 @@ public:
 		{
 			DestructInterval(0, Size - 1);
 		}
-		_aligned_free(Data);
+		FreeData(Data, AllocSize);
 	}
 
 	void clear()
@@ -248,7 +458,7 @@ public:
 		{
 			DestructInterval(0, Size - 1);
 		}
-		_aligned_free(Data);
+		FreeData(Data, AllocSize);
 		Size = 0;
 		AllocSize = 0;
 		Data = NULL;
@@ -269,6 +479,31 @@ public:
 		return AllocSize;
 	}
 
+	//! уменьшает выделенную память до текущего размера
+	void shrink_to_fit()
+	{
+		if(!this->Size)
+		{
+			FreeData(this->Data, this->AllocSize);
+			this->Data = NULL;
+			this->AllocSize = 0;
+		}
+		else
+		{
+			Realloc(this->Size);
+		}
+	}
+
+	//! количество перевыделений памяти массива, без ARRAY_STATS всегда 0
+	UINT getReallocCount() const
+	{
+#ifdef ARRAY_STATS
+		return(m_uReallocCount);
+#else
+		return(0);
+#endif
+	}
+
 	void quickSort()
 	{
 		quickSort([](const T &a, const T &b){
@@ -276,6 +511,13 @@ public:
 		});
 	}
 
+	void stableSort()
+	{
+		stableSort([](const T &a, const T &b){
+			return(a < b);
+		});
+	}
+
 	void insert(const T &data, int index)
 	{
 		insert(data, (UINT)index);
@@ -287,19 +529,17 @@ public:
 		{
 			(*this)[index] = data;
 		}
+		else if(&data >= this->Data && &data < this->Data + this->Size)
+		{
+			// вставляемый элемент сместится при сдвиге
+			T tmp(data);
+			insert(tmp, index);
+		}
 		else
 		{
-			bool wasRealloced = Size == AllocSize;
-			for(UINT i = Size; i > index; --i)
-			{
-				(*this)[i] = (*this)[i - 1];
-				if(wasRealloced)
-				{
-					wasRealloced = false;
-					(*this)[i] = (*this)[i - 1];
-				}
-			}
-			(*this)[index] = data;
+			Grow(this->Size + 1);
+			InsertShift(data, index, ArrayIsRelocatable<T>());
+			this->Size++;
 		}
 	}
 
@@ -318,13 +558,29 @@ public:
 		return(item + 1);
 	}
 
+	/*! Нестабильная сортировка (introsort): быстрая сортировка с медианой из трех,
+		при слишком глубокой рекурсии - пирамидальная, короткие диапазоны - вставками
+	*/
 	template <typename L>
 	void quickSort(const L& CompareFunc = [](const L &a, const L &b){return(a < b);})
 	{
 		//don't sort 0 or 1 elements
 		if(size() > 1)
 		{
-			quickSortInternal(CompareFunc, 0, size() - 1);
+			introSortInternal(CompareFunc, 0, size(), GetSortDepthLimit(size()));
+		}
+	}
+
+	//! стабильная сортировка слиянием, использует дополнительную память под половину массива
+	template <typename L>
+	void stableSort(const L& CompareFunc)
+	{
+		if(size() > 1)
+		{
+			UINT uBufferSize = (size() + 1) / 2;
+			T *pBuffer = (T*)Allocator::Alloc(sizeof(T) * uBufferSize, alignof(T));
+			mergeSortInternal(CompareFunc, 0, size(), pBuffer);
+			Allocator::Free(pBuffer, sizeof(T) * uBufferSize);
 		}
 	}
 
@@ -348,8 +604,110 @@ public:
 		return(-1);
 	}
 
-	template<typename O, int S = BlockSize>
-	void append(const Array<O, S> &other)
+	/*! Двоичный поиск в упорядоченном по Less массиве, без ветвлений в цикле.
+		lowerBound - первый элемент, для которого Less(элемент, value) ложно,
+		upperBound - первый элемент, для которого Less(value, элемент) истинно.
+		Если такого нет, возвращается size().
+		Для value другого типа O lowerBound нужен Less(const T&, const O&), а upperBound - Less(const O&, const T&)
+	*/
+	template <typename O, typename L>
+	UINT lowerBound(const O &value, const L &Less) const
+	{
+		if(!this->Size)
+		{
+			return(0);
+		}
+		const T *pBase = this->Data;
+		UINT uLen = this->Size;
+		while(uLen > 1)
+		{
+			UINT uHalf = uLen / 2;
+			pBase = Less(pBase[uHalf], value) ? pBase + uHalf : pBase;
+			uLen -= uHalf;
+		}
+		return((UINT)(pBase - this->Data) + (Less(*pBase, value) ? 1 : 0));
+	}
+
+	UINT lowerBound(const T &value) const
+	{
+		return(lowerBound(value, [](const T &a, const T &b){
+			return(a < b);
+		}));
+	}
+
+	template <typename O, typename L>
+	UINT upperBound(const O &value, const L &Less) const
+	{
+		if(!this->Size)
+		{
+			return(0);
+		}
+		const T *pBase = this->Data;
+		UINT uLen = this->Size;
+		while(uLen > 1)
+		{
+			UINT uHalf = uLen / 2;
+			pBase = !Less(value, pBase[uHalf]) ? pBase + uHalf : pBase;
+			uLen -= uHalf;
+		}
+		return((UINT)(pBase - this->Data) + (!Less(value, *pBase) ? 1 : 0));
+	}
+
+	UINT upperBound(const T &value) const
+	{
+		return(upperBound(value, [](const T &a, const T &b){
+			return(a < b);
+		}));
+	}
+
+	/*! индекс элемента, для которого Equals(элемент, value) истинно, или -1.
+		Less(элемент, value) и Equals(элемент, value) принимают элемент первым, поэтому value может иметь другой тип
+	*/
+	template <typename O, typename L, typename E>
+	int binarySearch(const O &value, const L &Less, const E &Equals) const
+	{
+		UINT uIdx = lowerBound(value, Less);
+		if(uIdx < this->Size && Equals(this->Data[uIdx], value))
+		{
+			return((int)uIdx);
+		}
+		return(-1);
+	}
+
+	//! индекс элемента, равного value в смысле Less, или -1. Less вызывается в обоих порядках аргументов
+	template <typename O, typename L>
+	int binarySearch(const O &value, const L &Less) const
+	{
+		return(binarySearch(value, Less, [&Less](const T &a, const O &b){
+			return(!Less(b, a));
+		}));
+	}
+
+	int binarySearch(const T &value) const
+	{
+		return(binarySearch(value, [](const T &a, const T &b){
+			return(a < b);
+		}));
+	}
+
+	//! вставляет data в упорядоченный массив после равных ему элементов, возвращает индекс
+	template <typename L>
+	UINT insertSorted(const T &data, const L &Less)
+	{
+		UINT uIdx = upperBound(data, Less);
+		insert(data, uIdx);
+		return(uIdx);
+	}
+
+	UINT insertSorted(const T &data)
+	{
+		return(insertSorted(data, [](const T &a, const T &b){
+			return(a < b);
+		}));
+	}
+
+	template<typename O, int S, bool D, typename A, typename G, UINT N>
+	void append(const Array<O, S, D, A, G, N> &other)
 	{
 		reserve(size() + other.size());
 
@@ -361,6 +719,10 @@ public:
 
 
 protected:
+	//! см. ArrayParallel.h
+	template <typename A, typename L>
+	friend void ArrayParallelSort(A &arr, const L &CompareFunc, UINT uThreads);
+
 	/*
 #ifdef S4G
 	friend s4g_Stack<T, BlockSize>;
@@ -370,29 +732,99 @@ protected:
 		Realloc(BlockSize);
 	}
 
+	//! обеспечивает место как минимум под uSize элементов
+	void Grow(UINT uSize)
+	{
+		if(uSize > this->AllocSize)
+		{
+			Realloc(uSize <= InlineCount ? InlineCount : Growth::GetCapacity(this->AllocSize, uSize, BlockSize));
+		}
+	}
+
 	void Realloc(UINT NewSize)
 	{
 		if(this->AllocSize == NewSize)
 		{
 			return;
 		}
-		T *tmpData = (T*)_aligned_malloc(sizeof(T) * NewSize, alignof(T));
+		if(InlineCount && NewSize <= InlineCount)
+		{
+			if(this->Size > NewSize)
+			{
+				DestructInterval(NewSize, this->Size - 1);
+				this->Size = NewSize;
+			}
+			if(!IsInline())
+			{
+				T *tmpDel = this->Data;
+				UINT tmpDelSize = this->AllocSize;
+				this->Data = this->GetInlineData();
+				RelocateInterval(this->Data, tmpDel, this->Size, ArrayIsRelocatable<T>());
+				FreeData(tmpDel, tmpDelSize);
+			}
+			this->AllocSize = InlineCount;
+			return;
+		}
+		if(this->Data && !IsInline() && NewSize >= this->Size && Allocator::Resize(this->Data, sizeof(T) * this->AllocSize, sizeof(T) * NewSize))
+		{
+			this->AllocSize = NewSize;
+			return;
+		}
+#ifdef ARRAY_STATS
+		++m_uReallocCount;
+#endif
+		T *tmpData = (T*)Allocator::Alloc(sizeof(T) * NewSize, alignof(T));
 		assert(tmpData);
 		if(!tmpData)
 		{
 			return;
 		}
-		memcpy(tmpData, this->Data, min(NewSize, this->Size) * sizeof(T));
 		if(this->Size > NewSize)
 		{
 			DestructInterval(NewSize, this->Size - 1);
 			this->Size = NewSize;
 		}
+		RelocateInterval(tmpData, this->Data, this->Size, ArrayIsRelocatable<T>());
 
-		this->AllocSize = NewSize;
 		T * tmpDel = this->Data;
+		UINT tmpDelSize = this->AllocSize;
+		this->AllocSize = NewSize;
 		this->Data = tmpData;
-		_aligned_free(tmpDel);
+		FreeData(tmpDel, tmpDelSize);
+	}
+
+	void FreeData(T *pData, UINT uAllocSize)
+	{
+		if(pData && (!InlineCount || pData != this->GetInlineData()))
+		{
+			Allocator::Free(pData, sizeof(T) * uAllocSize);
+		}
+	}
+
+	bool IsInline()
+	{
+		return(InlineCount && this->Data && this->Data == this->GetInlineData());
+	}
+
+	//! забирает элементы arr, массив должен быть без памяти, arr остается пустым
+	void TakeFrom(Array &arr)
+	{
+		assert(!this->Data);
+		if(arr.IsInline())
+		{
+			this->Data = this->GetInlineData();
+			RelocateInterval(this->Data, arr.Data, arr.Size, ArrayIsRelocatable<T>());
+		}
+		else
+		{
+			this->Data = arr.Data;
+		}
+		this->Size = arr.Size;
+		this->AllocSize = arr.AllocSize;
+
+		arr.Data = NULL;
+		arr.Size = 0;
+		arr.AllocSize = 0;
 	}
 
 	void ConstructInterval(UINT start, UINT end)
@@ -412,34 +844,283 @@ protected:
 		}
 	}
 
+	//! перенос uCount элементов в неинициализированную память pDst, исходные элементы уничтожаются
+	static void RelocateInterval(T *pDst, T *pSrc, UINT uCount, std::true_type)
+	{
+		if(uCount)
+		{
+			memcpy(pDst, pSrc, sizeof(T) * uCount);
+		}
+	}
+
+	static void RelocateInterval(T *pDst, T *pSrc, UINT uCount, std::false_type)
+	{
+		for(UINT i = 0; i < uCount; ++i)
+		{
+			new(&pDst[i]) T(std::move(pSrc[i]));
+			pSrc[i].~T();
+		}
+	}
+
+	//! копирование uCount элементов в неинициализированную память pDst
+	static void CopyInterval(T *pDst, const T *pSrc, UINT uCount)
+	{
+		CopyInterval(pDst, pSrc, uCount, std::is_trivially_copyable<T>());
+	}
+
+	static void CopyInterval(T *pDst, const T *pSrc, UINT uCount, std::true_type)
+	{
+		if(uCount)
+		{
+			memcpy(pDst, pSrc, sizeof(T) * uCount);
+		}
+	}
+
+	static void CopyInterval(T *pDst, const T *pSrc, UINT uCount, std::false_type)
+	{
+		for(UINT i = 0; i < uCount; ++i)
+		{
+			new(&pDst[i]) T(pSrc[i]);
+		}
+	}
+
+	//! присваивание uCount элементов существующим элементам pDst
+	static void AssignInterval(T *pDst, const T *pSrc, UINT uCount, std::true_type)
+	{
+		if(uCount)
+		{
+			memcpy(pDst, pSrc, sizeof(T) * uCount);
+		}
+	}
+
+	static void AssignInterval(T *pDst, const T *pSrc, UINT uCount, std::false_type)
+	{
+		for(UINT i = 0; i < uCount; ++i)
+		{
+			pDst[i] = pSrc[i];
+		}
+	}
+
+	//! удаляет элемент key со сдвигом хвоста, Size не меняется
+	void EraseShift(UINT key, std::true_type)
+	{
+		(&this->Data[key])->~T();
+		memmove(&this->Data[key], &this->Data[key + 1], sizeof(T) * (this->Size - key - 1));
+	}
+
+	void EraseShift(UINT key, std::false_type)
+	{
+		for(UINT i = key + 1; i < this->Size; ++i)
+		{
+			this->Data[i - 1] = std::move(this->Data[i]);
+		}
+		(&this->Data[this->Size - 1])->~T();
+	}
+
+	//! вставляет data в позицию index < Size со сдвигом хвоста, место под элемент уже выделено, Size не меняется
+	void InsertShift(const T &data, UINT index, std::true_type)
+	{
+		memmove(&this->Data[index + 1], &this->Data[index], sizeof(T) * (this->Size - index));
+		new(&this->Data[index]) T(data);
+	}
+
+	void InsertShift(const T &data, UINT index, std::false_type)
+	{
+		new(&this->Data[this->Size]) T(std::move(this->Data[this->Size - 1]));
+		for(UINT i = this->Size - 1; i > index; --i)
+		{
+			this->Data[i] = std::move(this->Data[i - 1]);
+		}
+		this->Data[index] = data;
+	}
+
+	static UINT GetSortDepthLimit(UINT uSize)
+	{
+		UINT uLog = 0;
+		while(uSize >>= 1)
+		{
+			++uLog;
+		}
+		return(uLog * 2);
+	}
+
+	//! сортирует [lo, hi)
 	template <typename L>
-	void quickSortInternal(const L& CompareFunc, int lo, int hi)
+	void introSortInternal(const L& CompareFunc, UINT lo, UINT hi, UINT uDepthLimit)
 	{
-		//  lo is the lower index, hi is the upper index
-		//  of the region of array a that is to be sorted
-		int i = lo, j = hi;
-		T x = Data[(lo + hi) / 2];
+		while(hi - lo > ARRAY_INSERTION_SORT_THRESHOLD)
+		{
+			if(!uDepthLimit--)
+			{
+				heapSortInternal(CompareFunc, lo, hi);
+				return;
+			}
+
+			UINT uSplit = partitionInternal(CompareFunc, lo, hi);
+
+			// рекурсия в меньшую часть, цикл по большей
+			if(uSplit - lo < hi - uSplit)
+			{
+				introSortInternal(CompareFunc, lo, uSplit, uDepthLimit);
+				lo = uSplit;
+			}
+			else
+			{
+				introSortInternal(CompareFunc, uSplit, hi, uDepthLimit);
+				hi = uSplit;
+			}
+		}
+		insertionSortInternal(CompareFunc, lo, hi);
+	}
 
-		//  partition
-		do
+	//! разбиение Хоара [lo, hi) по медиане из трех, обе части непустые
+	template <typename L>
+	UINT partitionInternal(const L& CompareFunc, UINT lo, UINT hi)
+	{
+		UINT mid = lo + (hi - lo - 1) / 2;
+		if(CompareFunc(Data[mid], Data[lo]))
 		{
-			while(CompareFunc(Data[i], x))
-				i++;
-			while(CompareFunc(x, Data[j]))
-				j--;
-			if(i <= j)
+			swap(mid, lo);
+		}
+		if(CompareFunc(Data[hi - 1], Data[mid]))
+		{
+			swap(hi - 1, mid);
+			if(CompareFunc(Data[mid], Data[lo]))
 			{
-				swap(i, j);
-				i++; j--;
+				swap(mid, lo);
 			}
 		}
-		while(i <= j);
 
-		//  recursion
-		if(lo < j)
-			quickSortInternal(CompareFunc, lo, j);
-		if(i < hi)
-			quickSortInternal(CompareFunc, i, hi);
+		T x = Data[mid];
+		int i = (int)lo - 1, j = (int)hi;
+		for(;;)
+		{
+			do
+			{
+				++i;
+			}
+			while(CompareFunc(Data[i], x));
+			do
+			{
+				--j;
+			}
+			while(CompareFunc(x, Data[j]));
+
+			if(i >= j)
+			{
+				return((UINT)j + 1);
+			}
+			swap(i, j);
+		}
+	}
+
+	template <typename L>
+	void heapSortInternal(const L& CompareFunc, UINT lo, UINT hi)
+	{
+		UINT n = hi - lo;
+		for(UINT i = n / 2; i > 0; --i)
+		{
+			siftDownInternal(CompareFunc, lo, i - 1, n);
+		}
+		for(UINT i = n - 1; i > 0; --i)
+		{
+			swap(lo, lo + i);
+			siftDownInternal(CompareFunc, lo, 0, i);
+		}
+	}
+
+	template <typename L>
+	void siftDownInternal(const L& CompareFunc, UINT base, UINT root, UINT n)
+	{
+		UINT child;
+		while((child = root * 2 + 1) < n)
+		{
+			if(child + 1 < n && CompareFunc(Data[base + child], Data[base + child + 1]))
+			{
+				++child;
+			}
+			if(!CompareFunc(Data[base + root], Data[base + child]))
+			{
+				return;
+			}
+			swap(base + root, base + child);
+			root = child;
+		}
+	}
+
+	//! стабильная сортировка вставками [lo, hi)
+	template <typename L>
+	void insertionSortInternal(const L& CompareFunc, UINT lo, UINT hi)
+	{
+		for(UINT i = lo + 1; i < hi; ++i)
+		{
+			if(CompareFunc(Data[i], Data[i - 1]))
+			{
+				T tmp(std::move(Data[i]));
+				UINT j = i;
+				do
+				{
+					Data[j] = std::move(Data[j - 1]);
+					--j;
+				}
+				while(j > lo && CompareFunc(tmp, Data[j - 1]));
+				Data[j] = std::move(tmp);
+			}
+		}
+	}
+
+	template <typename L>
+	void mergeSortInternal(const L& CompareFunc, UINT lo, UINT hi, T *pBuffer)
+	{
+		if(hi - lo <= ARRAY_INSERTION_SORT_THRESHOLD)
+		{
+			insertionSortInternal(CompareFunc, lo, hi);
+			return;
+		}
+		UINT mid = lo + (hi - lo) / 2;
+		mergeSortInternal(CompareFunc, lo, mid, pBuffer);
+		mergeSortInternal(CompareFunc, mid, hi, pBuffer);
+		mergeInternal(CompareFunc, lo, mid, hi, pBuffer);
+	}
+
+	/*! стабильно сливает упорядоченные [lo, mid) и [mid, hi), pBuffer - неинициализированная память
+		на mid - lo элементов, объекты в ней создаются перемещением и разрушаются до выхода
+	*/
+	template <typename L>
+	void mergeInternal(const L& CompareFunc, UINT lo, UINT mid, UINT hi, T *pBuffer)
+	{
+		if(!CompareFunc(Data[mid], Data[mid - 1]))
+		{
+			return;
+		}
+
+		UINT n = mid - lo;
+		for(UINT i = 0; i < n; ++i)
+		{
+			new(&pBuffer[i]) T(std::move(Data[lo + i]));
+		}
+
+		UINT i = 0, j = mid, k = lo;
+		while(i < n && j < hi)
+		{
+			if(CompareFunc(Data[j], pBuffer[i]))
+			{
+				Data[k++] = std::move(Data[j++]);
+			}
+			else
+			{
+				Data[k++] = std::move(pBuffer[i++]);
+			}
+		}
+		while(i < n)
+		{
+			Data[k++] = std::move(pBuffer[i++]);
+		}
+
+		for(i = 0; i < n; ++i)
+		{
+			pBuffer[i].~T();
+		}
 	}
 
 	void swap(int index0, int index1)
@@ -451,8 +1132,118 @@ protected:
 
 	UINT Size = 0;
 	UINT AllocSize = 0;
+#ifdef ARRAY_STATS
+	UINT m_uReallocCount = 0;
+#endif
+};
+
+//! массив со встроенными элементами хранит указатель на себя
+template<typename T, int BlockSize, bool fully_defined, typename Allocator, typename Growth, UINT InlineCount>
+struct ArrayIsRelocatable<Array<T, BlockSize, fully_defined, Allocator, Growth, InlineCount>>: std::integral_constant<bool, InlineCount == 0>
+{
 };
 
+/*! Упорядоченная таблица только для чтения в порядке Эйтцингера (дерево поиска в ширину в массиве).
+	Поиск обходит элементы в порядке, удобном для кэша и предвыборки, что быстрее двоичного поиска
+	в больших таблицах, которые часто читаются и редко меняются.
+	Индексы, возвращаемые поиском, - индексы в исходном упорядоченном массиве
+*/
+template<typename T>
+class EytzingerArray
+{
+public:
+	EytzingerArray() = default;
+
+	template<int S, bool D, typename A, typename G, UINT N>
+	explicit EytzingerArray(const Array<T, S, D, A, G, N> &aSorted)
+	{
+		build(aSorted);
+	}
+
+	//! строит таблицу из массива, упорядоченного по возрастанию
+	template<int S, bool D, typename A, typename G, UINT N>
+	void build(const Array<T, S, D, A, G, N> &aSorted)
+	{
+		m_aData.clearFast();
+		m_aIndex.clearFast();
+		m_aData.resize(aSorted.size() + 1);
+		m_aIndex.resize(aSorted.size() + 1);
+		m_aIndex[0] = aSorted.size();
+		m_aPosition.clearFast();
+		m_aPosition.resize(aSorted.size());
+
+		UINT uNext = 0;
+		Fill(aSorted, 1, uNext);
+	}
+
+	UINT size() const
+	{
+		return(m_aData.size() ? m_aData.size() - 1 : 0);
+	}
+
+	//! элемент с индексом uIdx исходного массива
+	const T& get(UINT uIdx) const
+	{
+		return(m_aData[m_aPosition[uIdx]]);
+	}
+
+	//! см. Array::lowerBound
+	template <typename O, typename L>
+	UINT lowerBound(const O &value, const L &Less) const
+	{
+		const T *pData = m_aData;
+		UINT n = size();
+		UINT k = 1;
+		while(k <= n)
+		{
+			// потомки через 4 уровня лежат подряд, загружаем их заранее
+#if defined(__SSE__) || defined(_M_X64)
+			_mm_prefetch((const char*)(pData + k * 16), _MM_HINT_T0);
+#endif
+			k = k * 2 + (Less(pData[k], value) ? 1 : 0);
+		}
+		// отбрасываем шаги вправо после последнего шага влево
+		while(k & 1)
+		{
+			k >>= 1;
+		}
+		k >>= 1;
+		return(m_aIndex[k]);
+	}
+
+	UINT lowerBound(const T &value) const
+	{
+		return(lowerBound(value, [](const T &a, const T &b){
+			return(a < b);
+		}));
+	}
+
+private:
+	template<typename A>
+	void Fill(const A &aSorted, UINT k, UINT &uNext)
+	{
+		if(k <= aSorted.size())
+		{
+			Fill(aSorted, k * 2, uNext);
+			m_aData[k] = aSorted[uNext];
+			m_aIndex[k] = uNext;
+			m_aPosition[uNext] = k;
+			++uNext;
+			Fill(aSorted, k * 2 + 1, uNext);
+		}
+	}
+
+	Array<T> m_aData;
+	Array<UINT> m_aIndex;
+	Array<UINT> m_aPosition;
+};
+
+/*! Массив, хранящий до N элементов внутри себя и выделяющий память только при переполнении.
+	Для коротких списков: ключей анимации, сегментов пути, ключей градиента
+*/
+template<typename T, UINT N, int BlockSize = 16, typename Allocator = HeapAllocator>
+using SmallArray = Array<T, BlockSize, true, Allocator, ArrayGrowGeometric, N>;
+
 template<>
 class Array<char>: public Array<char, 1024, false>
 {
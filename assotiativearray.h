@@ -9,6 +9,7 @@ See the license in LICENSE
 //#include "DSbase.h"
 #include <common/MemAlloc.h>
 #include <common/stack.h>
+#include <common/hash.h>
 #ifdef AA_DEBUG
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
@@ -27,7 +28,7 @@ See the license in LICENSE
 #endif
 
 
-template<typename SX_KEYTYPE, typename SX_VALTYPE, bool searchCache = false, int ReservePage = 256>
+template<typename SX_KEYTYPE, typename SX_VALTYPE, bool searchCache = false, int ReservePage = 256, typename Allocator = HeapAllocator>
 class AssotiativeArray
 {
 public:
@@ -45,7 +46,12 @@ private:
 	unsigned int Size_;
 	Node * RootNode;
 	
-	Node* TreeSearch(const SX_KEYTYPE &key) const
+	/*! поиск узла, кэш последнего найденного узла (searchCache) только читается,
+		обновляют его неконстантные методы, поэтому константные методы можно вызывать из нескольких потоков одновременно.
+		key - SX_KEYTYPE либо тип O, разрешенный XIsTransparentKey
+	*/
+	template<typename O>
+	Node* TreeSearch(const O &key) const
 	{
 		if(searchCache && TmpNode && TmpNode->Key == key)
 		{
@@ -57,12 +63,10 @@ private:
 		{
 			if(tmpCurNode->Key == key)
 			{
-				TmpNode = tmpCurNode;
 				return(tmpCurNode);
 			}
 			tmpCurNode = tmpCurNode->Key < key ? tmpCurNode->Right : tmpCurNode->Left;
 		}
-		TmpNode = NULL;
 		return(NULL);
 	}
 	void TreeRotateLeft(Node *node)
@@ -267,18 +271,20 @@ private:
 		node->IsBlack = true;
 	}
 
-	template<typename... Args>
-	Node* TreeInsert(const SX_KEYTYPE &key, bool *found, Args&&... args)
+	//! SX_KEYTYPE создается из key только при вставке нового узла
+	template<typename O, typename... Args>
+	Node* TreeInsert(const O &key, bool *found, Args&&... args)
 	{
 		Node * tmpCur;
 		Node * tmpParent;
 		Node * tmpNode;
+		bool isLeft = false;
 
 		tmpCur = this->RootNode;
 		tmpParent = NULL;
 		while(tmpCur)
 		{
-			if(key == tmpCur->Key)
+			if(tmpCur->Key == key)
 			{
 				//tmpCur->Val = val;
 				//memcpy(tmpCur->Val, &val, sizeof(SX_VALTYPE));
@@ -290,7 +296,8 @@ private:
 				return(tmpCur);
 			}
 			tmpParent = tmpCur;
-			tmpCur = key < tmpCur->Key ? tmpCur->Left : tmpCur->Right;
+			isLeft = !(tmpCur->Key < key);
+			tmpCur = isLeft ? tmpCur->Left : tmpCur->Right;
 		}
 		this->Size_++;
 		// tmpNode = new Node;
@@ -313,7 +320,7 @@ private:
 
 		if(tmpParent)
 		{
-			if(key < tmpParent->Key)
+			if(isLeft)
 			{
 				tmpParent->Left = tmpNode;
 			}
@@ -457,11 +464,14 @@ private:
 		pB->IsBlack = oldAColor;
 	}
 
-	void TreeDelete(const SX_KEYTYPE &key)
+	template<typename O>
+	void TreeDelete(const O &key)
 	{
 		Node *pNode = TreeSearch(key);
 		if(pNode)
 		{
+			// узел удаляется, кэш поиска не должен на него указывать
+			TmpNode = NULL;
 			this->Size_--;
 			// case R2, B2
 			if(pNode->Left && pNode->Right)
@@ -556,6 +566,29 @@ private:
 		}
 	}
 
+	template<typename O>
+	bool KeyExistsImpl(const O &key, const Node **pNode) const
+	{
+		const Node *pFound = TreeSearch(key);
+		if(pNode)
+		{
+			*pNode = pFound;
+		}
+		return(pFound != NULL);
+	}
+
+	template<typename O>
+	bool KeyExistsImpl(const O &key, const Node **pNode, bool create)
+	{
+		bool found = !create;
+		TmpNode = create ? TreeInsert(key, &found) : TreeSearch(key);
+		if(pNode)
+		{
+			*pNode = TmpNode;
+		}
+		return(TmpNode != NULL && found);
+	}
+
 	Node* minValueNode(Node *node)
 	{
 		Node *ptr = node;
@@ -568,6 +601,48 @@ private:
 		return(ptr);
 	}
 
+	/*! связывает узлы, упорядоченные по ключу, в сбалансированное дерево и делает его корнем.
+		Все листья оказываются на двух нижних уровнях, узлы самого нижнего уровня красятся в красный,
+		остальные - в черный, поэтому черная высота всех ветвей одинакова
+	*/
+	void LinkBalanced(Node **ppNodes, UINT uCount)
+	{
+		UINT uMaxDepth = 0;
+		while((2u << uMaxDepth) <= uCount)
+		{
+			++uMaxDepth;
+		}
+		this->RootNode = LinkBalanced(ppNodes, uCount, NULL, 0, uMaxDepth);
+		this->Size_ = uCount;
+		this->TmpNode = NULL;
+	}
+
+	Node* LinkBalanced(Node **ppNodes, UINT uCount, Node *pParent, UINT uDepth, UINT uMaxDepth)
+	{
+		if(!uCount)
+		{
+			return(NULL);
+		}
+		UINT uMid = uCount / 2;
+		Node *pNode = ppNodes[uMid];
+		pNode->Parent = pParent;
+		pNode->IsBlack = !uDepth || uDepth < uMaxDepth;
+		pNode->Left = LinkBalanced(ppNodes, uMid, pNode, uDepth + 1, uMaxDepth);
+		pNode->Right = LinkBalanced(ppNodes + uMid + 1, uCount - uMid - 1, pNode, uDepth + 1, uMaxDepth);
+		return(pNode);
+	}
+
+	//! собирает узлы в порядке возрастания ключей
+	static void CollectNodes(Node *pNode, Array<Node*> &aNodes)
+	{
+		while(pNode)
+		{
+			CollectNodes(pNode->Left, aNodes);
+			aNodes.push_back(pNode);
+			pNode = pNode->Right;
+		}
+	}
+
 #ifdef AA_DEBUG
 	bool TestNode(Node *pNode, int iDepth, int *pMaxDepth)
 	{
@@ -653,8 +728,8 @@ private:
 	}
 #endif
 
-	MemAlloc<Node, ReservePage, 8> MemNodes;
-	MemAlloc<SX_VALTYPE, ReservePage, 8> MemVals;
+	MemAlloc<Node, ReservePage, 8, alignof(Node), MemAllocHeaderLayout, Allocator> MemNodes;
+	MemAlloc<SX_VALTYPE, ReservePage, 8, alignof(SX_VALTYPE), MemAllocHeaderLayout, Allocator> MemVals;
 public:
 
 #ifdef AA_DEBUG
@@ -800,10 +875,17 @@ public:
 
 	AssotiativeArray(const AssotiativeArray & a):RootNode(NULL), Size_(0), TmpNode(NULL)
 	{
-		for(typename AssotiativeArray<SX_KEYTYPE, SX_VALTYPE>::Iterator i = a.begin(); i; ++i)
-		{
-			(*this)[*(i.first)] = *(i.second);
+		// элементы a уже упорядочены, дерево строится сразу сбалансированным
+		Array<Node*> aNodes;
+		aNodes.reserve(a.Size_);
+		for(Iterator i = a.begin(); i; ++i)
+		{
+			Node *pNode = this->MemNodes.Alloc();
+			pNode->Key = *(i.first);
+			pNode->Val = this->MemVals.Alloc(*(i.second));
+			aNodes.push_back(pNode);
 		}
+		LinkBalanced(aNodes.data(), aNodes.size());
 	}
 
 	/*AssotiativeArray(const AssotiativeArray & a)
@@ -815,25 +897,34 @@ public:
 	//printf("AssotiativeArray()\n");
 	}*/
 
+	/*! Методы поиска принимают SX_KEYTYPE, а также ключи типов O, разрешенных XIsTransparentKey<SX_KEYTYPE, O>
+		(например const char* и StringView для String), без создания временного SX_KEYTYPE.
+		Ключи остальных типов приводятся к SX_KEYTYPE
+	*/
+	template<typename O, typename R>
+	using IfTransparentKey = typename std::enable_if<XIsTransparentKey<SX_KEYTYPE, typename std::decay<O>::type>::value, R>::type;
+
 	bool KeyExists(const SX_KEYTYPE & key, const Node ** pNode = NULL) const
 	{
-		TmpNode = TreeSearch(key);
-		if(pNode)
-		{
-			*pNode = TmpNode;
-		}
-		return(TmpNode != NULL);
+		return(KeyExistsImpl(key, pNode));
+	}
+
+	template<typename O>
+	IfTransparentKey<O, bool> KeyExists(const O & key, const Node ** pNode = NULL) const
+	{
+		return(KeyExistsImpl(key, pNode));
 	}
 
+	//! при create == true ключ SX_KEYTYPE создается из key, только если его нет в массиве
 	bool KeyExists(const SX_KEYTYPE & key, const Node ** pNode = NULL, bool create = false)
 	{
-		bool found = !create;
-		TmpNode = create ? TreeInsert(key, &found) : TreeSearch(key);
-		if(pNode)
-		{
-			*pNode = TmpNode;
-		}
-		return(TmpNode != NULL && found);
+		return(KeyExistsImpl(key, pNode, create));
+	}
+
+	template<typename O>
+	IfTransparentKey<O, bool> KeyExists(const O & key, const Node ** pNode = NULL, bool create = false)
+	{
+		return(KeyExistsImpl(key, pNode, create));
 	}
 	template<typename... Args>
 	const Node* insert(const SX_KEYTYPE &key, Args&&... args)
@@ -842,9 +933,105 @@ public:
 		return(TmpNode);
 	}
 
+	//! элемент для пакетного построения массива
+	struct BulkEntry
+	{
+		SX_KEYTYPE Key;
+		SX_VALTYPE Val;
+	};
+
+	/*! заменяет содержимое массива элементами aEntries за O(n) без балансировок.
+		Если isSorted == false, aEntries сортируется по ключу на месте.
+		Из элементов с одинаковыми ключами остается последний, как при последовательной вставке.
+		Узлы выделяются подряд в порядке ключей, поэтому обход по порядку идет по соседней памяти
+	*/
+	template<int BlockSize, bool fully_defined, typename A, typename G, UINT InlineCount>
+	void build(Array<BulkEntry, BlockSize, fully_defined, A, G, InlineCount> &aEntries, bool isSorted = false)
+	{
+		clear();
+		if(!isSorted)
+		{
+			aEntries.stableSort([](const BulkEntry &a, const BulkEntry &b){
+				return(a.Key < b.Key);
+			});
+		}
+
+		const BulkEntry *pEntries = aEntries.data();
+		UINT uCount = aEntries.size();
+		Array<Node*> aNodes;
+		aNodes.reserve(uCount);
+		for(UINT i = 0; i < uCount; ++i)
+		{
+			if(i + 1 < uCount && !(pEntries[i].Key < pEntries[i + 1].Key))
+			{
+				assert(pEntries[i].Key == pEntries[i + 1].Key && "aEntries is not sorted");
+				continue;
+			}
+			Node *pNode = this->MemNodes.Alloc();
+			pNode->Key = pEntries[i].Key;
+			pNode->Val = this->MemVals.Alloc(pEntries[i].Val);
+			aNodes.push_back(pNode);
+		}
+		LinkBalanced(aNodes.data(), aNodes.size());
+	}
+
+	/*! удаляет все элементы, для которых pred(key, value) возвращает true, возвращает количество удаленных.
+		Оставшиеся узлы перестраиваются в сбалансированное дерево за O(n), вместо удаления по одному
+	*/
+	template<typename L>
+	UINT eraseIf(const L &pred)
+	{
+		Array<Node*> aNodes;
+		aNodes.reserve(this->Size_);
+		CollectNodes(this->RootNode, aNodes);
+
+		UINT uKept = 0;
+		for(UINT i = 0, l = aNodes.size(); i < l; ++i)
+		{
+			Node *pNode = aNodes[i];
+			if(pred((const SX_KEYTYPE&)pNode->Key, *pNode->Val))
+			{
+				this->MemVals.Delete(pNode->Val);
+				this->MemNodes.Delete(pNode);
+			}
+			else
+			{
+				aNodes[uKept++] = pNode;
+			}
+		}
+
+		UINT uErased = aNodes.size() - uKept;
+		LinkBalanced(aNodes.data(), uKept);
+		return(uErased);
+	}
+
+	/*! удаляет элементы с ключами из aKeys, возвращает количество удаленных.
+		Если isSorted == false, aKeys сортируется на месте
+	*/
+	template<int BlockSize, bool fully_defined, typename A, typename G, UINT InlineCount>
+	UINT eraseKeys(Array<SX_KEYTYPE, BlockSize, fully_defined, A, G, InlineCount> &aKeys, bool isSorted = false)
+	{
+		if(!isSorted)
+		{
+			aKeys.quickSort();
+		}
+
+		// обход дерева идет по возрастанию ключей, поэтому удаляемые ключи просматриваются одним проходом
+		const SX_KEYTYPE *pKeys = aKeys.data();
+		UINT uKeys = aKeys.size();
+		UINT uKey = 0;
+		return(eraseIf([&](const SX_KEYTYPE &key, const SX_VALTYPE&){
+			while(uKey < uKeys && pKeys[uKey] < key)
+			{
+				++uKey;
+			}
+			return(uKey < uKeys && pKeys[uKey] == key);
+		}));
+	}
+
 	AssotiativeArray & operator=(const AssotiativeArray & a)
 	{
-		for(typename AssotiativeArray<SX_KEYTYPE, SX_VALTYPE>::Iterator i = a.begin(); i; i++)
+		for(Iterator i = a.begin(); i; i++)
 		{
 			this->operator[](*i.first) = *i.second;
 		}
@@ -873,14 +1060,32 @@ public:
 
 	const SX_VALTYPE & operator[](const SX_KEYTYPE & key) const
 	{
-		TmpNode = TreeSearch(key);
-		return(*TmpNode->Val);
+		return(*TreeSearch(key)->Val);
 	}
 
 	const SX_VALTYPE * at(const SX_KEYTYPE & key) const
 	{
-		TmpNode = TreeSearch(key);
-		return(TmpNode ? TmpNode->Val : NULL);
+		const Node *pFound = TreeSearch(key);
+		return(pFound ? pFound->Val : NULL);
+	}
+
+	template<typename O>
+	IfTransparentKey<O, const SX_VALTYPE*> at(const O & key) const
+	{
+		const Node *pFound = TreeSearch(key);
+		return(pFound ? pFound->Val : NULL);
+	}
+
+	//! узел с ключом key или NULL
+	const Node * find(const SX_KEYTYPE & key) const
+	{
+		return(TreeSearch(key));
+	}
+
+	template<typename O>
+	IfTransparentKey<O, const Node*> find(const O & key) const
+	{
+		return(TreeSearch(key));
 	}
 
 //	void Insert(const SX_KEYTYPE & key, const SX_VALTYPE & val);
@@ -904,9 +1109,16 @@ public:
 		TreeDelete(key);
 	}
 
+	template<typename O>
+	IfTransparentKey<O, void> erase(const O &key)
+	{
+		TreeDelete(key);
+	}
+
 	void clear()
 	{
 		this->RootNode = NULL;
+		this->TmpNode = NULL;
 		MemNodes.clear();
 		MemVals.clear();
 		this->Size_ = 0;
@@ -947,8 +1159,8 @@ public:
 #endif
 };
 
-template<typename SX_KEYTYPE, typename SX_VALTYPE, bool searchCache = false, int ReservePage = 256>
-using Map = AssotiativeArray<SX_KEYTYPE, SX_VALTYPE, searchCache, ReservePage>;
+template<typename SX_KEYTYPE, typename SX_VALTYPE, bool searchCache = false, int ReservePage = 256, typename Allocator = HeapAllocator>
+using Map = AssotiativeArray<SX_KEYTYPE, SX_VALTYPE, searchCache, ReservePage, Allocator>;
 
 #if defined(_WINDOWS)
 #	pragma warning(pop)
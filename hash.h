@@ -0,0 +1,117 @@
+/******************************************************
+Copyright © Vitaliy Buturlin, Evgeny Danilovich, 2017
+See the license in LICENSE
+******************************************************/
+
+#ifndef __COMMON_HASH_H
+#define __COMMON_HASH_H
+
+#include <type_traits>
+#include "types.h"
+
+/*! Функции хеширования для HashMap.
+	XHash<T> - функтор size_t operator()(const T&), результат должен быть хорошо перемешан во всех битах,
+	HashMap берет младшие биты как метку ячейки, а старшие - как позицию.
+	Для собственных типов ключей специализации объявляются рядом с типом (см. string.h, AAString.h)
+*/
+
+//! перемешивание 64-битного значения (финализатор MurmurHash3)
+inline uint64_t XHashMix(uint64_t ullValue)
+{
+	ullValue ^= ullValue >> 33;
+	ullValue *= 0xff51afd7ed558ccdULL;
+	ullValue ^= ullValue >> 33;
+	ullValue *= 0xc4ceb9fe1a85ec53ULL;
+	ullValue ^= ullValue >> 33;
+	return(ullValue);
+}
+
+//! добавляет значение к накопленному хешу
+inline uint64_t XHashCombine(uint64_t ullSeed, uint64_t ullValue)
+{
+	return((ullSeed ^ ullValue) * 0x9e3779b97f4a7c15ULL + (ullSeed >> 29));
+}
+
+//! хеш произвольного блока памяти, обрабатывается по 8 байт
+inline uint64_t XHashBytes(const void *pData, size_t uSize)
+{
+	const byte *pBytes = (const byte*)pData;
+	uint64_t ullHash = uSize * 0x9e3779b97f4a7c15ULL;
+
+	for(; uSize >= 8; uSize -= 8, pBytes += 8)
+	{
+		uint64_t ullChunk;
+		memcpy(&ullChunk, pBytes, 8);
+		ullHash = XHashCombine(ullHash, ullChunk);
+	}
+
+	if(uSize)
+	{
+		uint64_t ullChunk = 0;
+		memcpy(&ullChunk, pBytes, uSize);
+		ullHash = XHashCombine(ullHash, ullChunk);
+	}
+
+	return(XHashMix(ullHash));
+}
+
+//! хеш целых чисел, перечислений и указателей
+template<typename T>
+struct XHash
+{
+	static_assert(std::is_integral<T>::value || std::is_enum<T>::value || std::is_pointer<T>::value, "XHash is not specialized for this type");
+
+	size_t operator()(const T &value) const
+	{
+		return((size_t)XHashMix((uint64_t)value));
+	}
+};
+
+//! числа с плавающей точкой хешируются по битам, 0.0 и -0.0 дают один хеш
+template<>
+struct XHash<float>
+{
+	size_t operator()(float fValue) const
+	{
+		uint32_t uBits = 0;
+		if(fValue != 0.0f)
+		{
+			memcpy(&uBits, &fValue, sizeof(uBits));
+		}
+		return((size_t)XHashMix(uBits));
+	}
+};
+
+template<>
+struct XHash<double>
+{
+	size_t operator()(double fValue) const
+	{
+		uint64_t ullBits = 0;
+		if(fValue != 0.0)
+		{
+			memcpy(&ullBits, &fValue, sizeof(ullBits));
+		}
+		return((size_t)XHashMix(ullBits));
+	}
+};
+
+template<>
+struct XHash<XGUID>
+{
+	size_t operator()(const XGUID &guid) const
+	{
+		return((size_t)XHashBytes(&guid, sizeof(guid)));
+	}
+};
+
+/*! Разрешает искать ключи K в AssotiativeArray по значению типа O без создания временного K,
+	для этого у K должны быть определены K == O и K < O. По умолчанию запрещено, и O приводится к K.
+	Специализации объявляются рядом с типом ключа (см. string.h, AAString.h)
+*/
+template<typename K, typename O>
+struct XIsTransparentKey: std::false_type
+{
+};
+
+#endif
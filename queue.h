@@ -4,13 +4,13 @@
 #include <common/MemAlloc.h>
 #include <common/types.h>
 
-template <typename T, int pageSize = 256>
+template <typename T, int pageSize = 256, typename Allocator = HeapAllocator>
 class Queue
 {
 public:
 	Queue() = default;
 
-	Queue(const Queue<T> &other) = delete;
+	Queue(const Queue &other) = delete;
 
 	Queue& operator=(const Queue &other) = delete;
 	
@@ -98,7 +98,7 @@ private:
 
 	SpinLock m_lock;
 
-	MemAlloc<QueueNode, pageSize, 16> m_poolData;
+	MemAlloc<QueueNode, pageSize, 16, alignof(QueueNode), MemAllocHeaderLayout, Allocator> m_poolData;
 
 	QueueNode* m_pHeadNode = NULL;
 	QueueNode* m_pTailNode = NULL;
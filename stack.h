@@ -14,7 +14,7 @@ See the license in LICENSE
 #	pragma warning(disable:4715)
 #endif
 
-template <typename T, int pageSize = 256, int alignBy = alignof(T)>
+template <typename T, int pageSize = 256, int alignBy = alignof(T), typename Allocator = HeapAllocator>
 #undef STACK_DEFAULT_ALIGN
 class Stack
 {
@@ -24,7 +24,7 @@ class Stack
 		StackNode *Parent;
 	};
 
-	MemAlloc<StackNode, pageSize> Data;
+	MemAlloc<StackNode, pageSize, 16, alignof(StackNode), MemAllocHeaderLayout, Allocator> Data;
 	int SP;
 
 	StackNode * CurrentNode;
@@ -36,7 +36,7 @@ public:
 		//printf("Stack()\n");
 	}
 
-	Stack(const Stack<T> & st)
+	Stack(const Stack & st)
 	{
 		//printf("Stack()\n");
 		this->CurrentNode = st.CurrentNode;
@@ -44,7 +44,7 @@ public:
 		this->SP = st.SP;
 	}
 
-	Stack & operator=(const Stack<T> & st)
+	Stack & operator=(const Stack & st)
 	{
 		this->CurrentNode = st.CurrentNode;
 		this->Data = st.Data;
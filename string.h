@@ -13,6 +13,9 @@ See the license in LICENSE
 #include <cstring>
 #include <cwchar>
 #include "types.h"
+#include "Allocator.h"
+#include "MemArena.h"
+#include "hash.h"
 
 #ifdef _WIN32
 #	define WIN32_LEAN_AND_MEAN
@@ -142,6 +145,26 @@ static const wchar_t* xmemcpy(wchar_t *dest, const wchar_t *source, size_t len)
 	return(wmemcpy(dest, source, len));
 }
 
+static int xmemcmp(const char *left, const char *right, size_t len)
+{
+	return(len ? memcmp(left, right, len) : 0);
+}
+
+static int xmemcmp(const wchar_t *left, const wchar_t *right, size_t len)
+{
+	return(len ? wmemcmp(left, right, len) : 0);
+}
+
+static const char* xmemchr(const char *str, char sym, size_t len)
+{
+	return((const char*)memchr(str, sym, len));
+}
+
+static const wchar_t* xmemchr(const wchar_t *str, wchar_t sym, size_t len)
+{
+	return(wmemchr(str, sym, len));
+}
+
 static int xstricmp(const char *left, const char *right)
 {
 	return(strcasecmp(left, right));
@@ -153,15 +176,19 @@ static int xstricmp(const wchar_t *left, const char *right)
 }
 
 template <typename... T>
-static int xsprintf(char *dest, const char* format, T... args)
+static int xsnprintf(char *dest, size_t count, const char* format, T... args)
 {
-	return(sprintf(dest, format, args...));
+	return(snprintf(dest, count, format, args...));
 }
 
 template <typename... T>
-static int xsprintf(wchar_t *dest, const char* format, T... args)
+static int xsnprintf(wchar_t *dest, size_t count, const char* format, T... args)
 {
-	return(swprintf(dest, CMB2WC(format), args...));
+#if defined(_WIN32)
+	return(_snwprintf(dest, count, CMB2WC(format), args...));
+#else
+	return(swprintf(dest, count, CMB2WC(format), args...));
+#endif
 }
 
 template <typename... T>
@@ -179,45 +206,189 @@ static int xsscanf(const wchar_t *source, const char* format, T... args)
 class String;
 class StringW;
 
-template <typename T, typename Derived>
-class StringBase
+template <typename T, typename Derived, typename Allocator>
+class StringBase;
+
+/*! Участок строки без владения памятью: указатель и длина, завершающий ноль не обязателен.
+	Принимается операторами StringBase и функциями string_utils наравне с const char*,
+	подстроки и поиск через него не выделяют память и не пересчитывают длину.
+	@note действителен, пока жива и не изменяется строка, на которую указывает
+*/
+template <typename T>
+class StringViewBase
 {
 public:
-	StringBase()
+	StringViewBase() = default;
+
+	StringViewBase(const T *str):
+		m_pStr(str),
+		m_uLength(str ? xstrlen(str) : 0)
 	{
-		m_data.stack.size = 0;
-		m_data.stack.szStr[0] = 0;
 	}
 
-	StringBase(const T *str)
+	StringViewBase(const T *str, size_t len):
+		m_pStr(str),
+		m_uLength(len)
+	{
+	}
+
+	template <typename Derived, typename Allocator>
+	StringViewBase(const StringBase<T, Derived, Allocator> &str):
+		m_pStr(str.c_str()),
+		m_uLength(str.length())
+	{
+	}
+
+	const T* data() const
+	{
+		return(m_pStr);
+	}
+
+	size_t length() const
+	{
+		return(m_uLength);
+	}
+
+	const T& operator[](size_t index) const
+	{
+		assert(index < m_uLength);
+		return(m_pStr[index]);
+	}
+
+	StringViewBase substr(size_t pos, size_t len = EOS) const
 	{
-		size_t len = xstrlen(str);
-		if(len + 1 <= getStackSize())
+		if(pos >= m_uLength)
 		{
-			xstrcpy(m_data.stack.szStr, str);
-			m_data.stack.size = (byte)len;
+			return(StringViewBase());
 		}
-		else
+		if(len > m_uLength - pos)
 		{
-			m_isStack = false;
-			m_data.heap.capacity = calcCapacity(len);
-			m_data.heap.size = len;
-			m_data.heap.szStr = new T[capacity()];
-			xstrcpy(m_data.heap.szStr, str);
+			len = m_uLength - pos;
 		}
+		return(StringViewBase(m_pStr + pos, len));
 	}
 
-	StringBase(T sym)
+	size_t find(T c, size_t pos = 0) const
+	{
+		if(pos >= m_uLength)
+		{
+			return(EOS);
+		}
+		const T *it = xmemchr(m_pStr + pos, c, m_uLength - pos);
+		return(it ? (size_t)(it - m_pStr) : EOS);
+	}
+
+	//! первое вхождение str не раньше pos, пустая строка находится в позиции pos
+	size_t find(const StringViewBase &str, size_t pos = 0) const
+	{
+		if(pos > m_uLength || str.m_uLength > m_uLength - pos)
+		{
+			return(EOS);
+		}
+		if(!str.m_uLength)
+		{
+			return(pos);
+		}
+
+		const T *it = m_pStr + pos;
+		const T *last = m_pStr + m_uLength - str.m_uLength;
+		while(it <= last && (it = xmemchr(it, str.m_pStr[0], last - it + 1)))
+		{
+			if(!xmemcmp(it + 1, str.m_pStr + 1, str.m_uLength - 1))
+			{
+				return((size_t)(it - m_pStr));
+			}
+			++it;
+		}
+		return(EOS);
+	}
+
+	int compare(const StringViewBase &str) const
+	{
+		int iResult = xmemcmp(m_pStr, str.m_pStr, m_uLength < str.m_uLength ? m_uLength : str.m_uLength);
+		if(iResult)
+		{
+			return(iResult);
+		}
+		return(m_uLength < str.m_uLength ? -1 : (m_uLength > str.m_uLength ? 1 : 0));
+	}
+
+	bool operator==(const StringViewBase &str) const
+	{
+		return(m_uLength == str.m_uLength && !xmemcmp(m_pStr, str.m_pStr, m_uLength));
+	}
+
+	bool operator!=(const StringViewBase &str) const
+	{
+		return(!(*this == str));
+	}
+
+	bool operator<(const StringViewBase &str) const
+	{
+		return(compare(str) < 0);
+	}
+
+	static const size_t EOS = (size_t)-1;
+
+private:
+	const T *m_pStr = NULL;
+	size_t m_uLength = 0;
+};
+
+typedef StringViewBase<char> StringView;
+typedef StringViewBase<wchar_t> StringViewW;
+
+//! признак строки в куче - старший бит последнего байта объекта, он же старший байт Heap::capacity
+#define STRING_HEAP_FLAG ((size_t)0x80 << ((sizeof(size_t) - 1) * 8))
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#	error StringBase keeps its heap flag in the high byte of capacity and requires a little-endian target
+#endif
+
+/*! Строка с хранением коротких значений внутри объекта.
+	Объект занимает три машинных слова (24 байта на x64): указатель, длина и объем буфера в куче,
+	либо сами символы. Последний байт объекта различает режимы: в куче в нем выставлен STRING_HEAP_FLAG,
+	внутри объекта он хранит число свободных символов и при полном заполнении служит завершающим нулем,
+	поэтому String вмещает 23 символа без выделения памяти.
+*/
+template <typename T, typename Derived, typename Allocator = HeapAllocator>
+class StringBase
+{
+public:
+	typedef StringViewBase<T> View;
+
+	StringBase()
+	{
+		setStack();
+	}
+
+	StringBase(const T *str)
+	{
+		setStack();
+		assign(str, xstrlen(str));
+	}
+
+	StringBase(const T *str, size_t len)
+	{
+		setStack();
+		assign(str, len);
+	}
+
+	StringBase(const View &str)
 	{
-		m_data.stack.szStr[0] = sym;
-		m_data.stack.szStr[1] = 0;
+		setStack();
+		assign(str.data(), str.length());
+	}
 
-		m_data.stack.size = 1;
+	StringBase(T sym)
+	{
+		setStack();
+		assign(&sym, 1);
 	}
 
 	StringBase(int num)
 	{
-		m_data.stack.size = (byte)xsprintf(m_data.stack.szStr, "%d", num);
+		initFormat("%d", num);
 	}
 
 	StringBase(int64_t num)
@@ -232,7 +403,7 @@ public:
 
 	StringBase(UINT num)
 	{
-		m_data.stack.size = (byte)xsprintf(m_data.stack.szStr, "%u", num);
+		initFormat("%u", num);
 	}
 
 	StringBase(double num)
@@ -247,73 +418,72 @@ public:
 
 	explicit StringBase(bool bf)
 	{
-		m_data.stack.size = (byte)xsprintf(m_data.stack.szStr, "%s", (bf ? "true" : "false"));
+		static const T s_aTrue[] = {'t', 'r', 'u', 'e'};
+		static const T s_aFalse[] = {'f', 'a', 'l', 's', 'e'};
+
+		setStack();
+		if(bf)
+		{
+			assign(s_aTrue, ARRAYSIZE(s_aTrue));
+		}
+		else
+		{
+			assign(s_aFalse, ARRAYSIZE(s_aFalse));
+		}
 	}
 
 	StringBase(const Derived &str)
 	{
-		*this = str;
+		setStack();
+		assign(str.c_str(), str.length());
 	}
 
 	StringBase(Derived &&other)
 	{
-		*this = std::move(other);
+		m_data = other.m_data;
+		other.setStack();
 	}
 
 	~StringBase()
 	{
-		release();
+		freeHeap();
 	}
 
 	void release()
 	{
-		if(!m_isStack)
+		freeHeap();
+		setStack();
+	}
+
+	Derived operator+(const View &str) const
+	{
+		Derived result;
+		size_t len = length();
+		T *szDest = result.reserveBuffer(len + str.length());
+
+		xmemcpy(szDest, c_str(), len);
+		if(str.length())
 		{
-			mem_delete_a(m_data.heap.szStr);
-			m_data.heap.capacity = 0;
-			m_isStack = true;
+			xmemcpy(szDest + len, str.data(), str.length());
 		}
-		m_data.stack.szStr[0] = 0;
-		m_data.stack.size = 0;
+		result.setLength(len + str.length());
+
+		return(result);
 	}
 
 	Derived operator+(const Derived &str) const
 	{
-		return(*this + str.c_str());
+		return(*this + View(str));
 	}
 
 	Derived operator+(const T *str) const
 	{
-		Derived result;
-		size_t size = 0;
-		const T *szLeft = NULL;
-		const T *szRight = NULL;
-
-		size = length() + xstrlen(str);
-
-		if(size + 1 > getStackSize())
-		{
-			result.m_isStack = false;
-			result.m_data.heap.capacity = calcCapacity(size);
-			result.m_data.heap.size = size;
-			result.m_data.heap.szStr = new T[result.capacity()];
-
-			xstrcpy(result.m_data.heap.szStr, c_str());
-			xstrcat(result.m_data.heap.szStr, str);
-
-			return(result);
-		}
-
-		result.m_data.stack.size = (byte)size;
-		xstrcpy(result.m_data.stack.szStr, c_str());
-		xstrcat(result.m_data.stack.szStr, str);
-
-		return(result);
+		return(*this + View(str));
 	}
 
 	Derived operator+(T sym) const
 	{
-		return(*this + Derived(sym));
+		return(*this + View(&sym, 1));
 	}
 
 	Derived operator+(int num) const
@@ -353,7 +523,10 @@ public:
 
 	Derived &operator=(const Derived &str)
 	{
-		*this = str.c_str();
+		if(this != &str)
+		{
+			assign(str.c_str(), str.length());
+		}
 
 		return(*(Derived*)this);
 	}
@@ -363,7 +536,6 @@ public:
 		if(this != &other)
 		{
 			std::swap(m_data, other.m_data);
-			std::swap(m_isStack, other.m_isStack);
 		}
 
 		return(*(Derived*)this);
@@ -371,42 +543,21 @@ public:
 
 	Derived &operator=(const T *str)
 	{
-		if(c_str() != str)
-		{
-			T *dest = NULL;
-			size_t len = xstrlen(str);
-
-			if((m_isStack && len + 1 > getStackSize()) ||
-				(capacity() <= len))
-			{
-				release();
+		assign(str, xstrlen(str));
 
-				m_isStack = false;
-				m_data.heap.capacity = calcCapacity(len);
-				m_data.heap.size = len;
-				m_data.heap.szStr = new T[capacity()];
-				dest = m_data.heap.szStr;
-			}
-			else if(!m_isStack && capacity() >= len + 1)
-			{
-				m_data.heap.size = len;
-				dest = m_data.heap.szStr;
-			}
-			else
-			{
-				m_data.stack.size = (byte)len;
-				dest = m_data.stack.szStr;
-			}
+		return(*(Derived*)this);
+	}
 
-			xstrcpy(dest, str);
-		}
+	Derived &operator=(const View &str)
+	{
+		assign(str.data(), str.length());
 
 		return(*(Derived*)this);
 	}
 
 	Derived &operator=(T sym)
 	{
-		*this = Derived(sym);
+		assign(&sym, 1);
 
 		return(*(Derived*)this);
 	}
@@ -460,66 +611,32 @@ public:
 		return(*(Derived*)this);
 	}
 
-	Derived &operator+=(const Derived &str)
+	Derived &operator+=(const View &str)
 	{
-		return(*this += str.c_str());
+		append(str.data(), str.length());
+
+		return(*(Derived*)this);
 	}
 
-	Derived &operator+=(const T *str)
+	Derived &operator+=(const Derived &str)
 	{
-		bool selfPlus = c_str() == str;
-		size_t len = xstrlen(str) + length();
-
-		if(m_isStack && len + 1 <= getStackSize())
-		{
-			if(selfPlus)
-			{
-				xmemcpy(m_data.stack.szStr + length(), m_data.stack.szStr, length());
-				m_data.stack.szStr[len] = 0;
-			}
-			else
-			{
-				xstrcat(m_data.stack.szStr, str);
-			}
-
-			m_data.stack.size = (byte)len;
-
-			return(*(Derived*)this);
-		}
-		else if(!m_isStack && m_data.heap.capacity >= len + 1)
-		{
-			if(selfPlus)
-			{
-				xmemcpy(m_data.heap.szStr + length(), m_data.heap.szStr, length());
-				m_data.stack.szStr[len] = 0;
-			}
-			else
-			{
-				xstrcat(m_data.heap.szStr, str);
-			}
-
-			m_data.heap.size = len;
-
-			return(*(Derived*)this);
-		}
+		append(str.c_str(), str.length());
 
-		size_t capacity = calcCapacity(len);
-		T *szBuff = new T[capacity];
-		xsprintf(szBuff, "%s%s", c_str(), str);
-
-		release();
+		return(*(Derived*)this);
+	}
 
-		m_isStack = false;
-		m_data.heap.szStr = szBuff;
-		m_data.heap.capacity = capacity;
-		m_data.heap.size = len;
+	Derived &operator+=(const T *str)
+	{
+		append(str, xstrlen(str));
 
 		return(*(Derived*)this);
 	}
 
 	Derived &operator+=(T sym)
 	{
-		return(*this += Derived(sym));
+		append(&sym, 1);
+
+		return(*(Derived*)this);
 	}
 
 	Derived &operator+=(int num)
@@ -557,59 +674,39 @@ public:
 		return(*this += Derived(bf));
 	}
 
-	Derived operator-(const Derived &str) const
-	{
-		return(*this - str.c_str());
-	}
-
-	Derived operator-(const T *str) const
+	//! строка без первого вхождения str
+	Derived operator-(const View &str) const
 	{
-		if(length() > 0)
+		size_t pos = find(str);
+		if(pos == EOS)
 		{
-			const T *pos = xstrstr(c_str(), str);
-			T *szBuf = NULL;
-
-			if(!pos)
-			{
-				return(*(Derived*)this);
-			}
-
-			Derived result;
-			size_t strlen = xstrlen(str);
-			size_t len = length() - strlen;
-			size_t count = pos - c_str();
-
-			if(len + 1 <= getStackSize())
-			{
-				result.m_data.stack.size = (byte)len;
-				szBuf = result.m_data.stack.szStr;
-
-				return(result);
-			}
-			else
-			{
-				result.m_isStack = false;
-				result.m_data.heap.capacity = calcCapacity(len);
-				result.m_data.heap.size = len;
-				result.m_data.heap.szStr = new T[result.capacity()];
+			return(*(const Derived*)this);
+		}
 
-				szBuf = result.m_data.heap.szStr;
-			}
+		Derived result;
+		size_t len = length() - str.length();
+		T *szDest = result.reserveBuffer(len);
 
+		xmemcpy(szDest, c_str(), pos);
+		xmemcpy(szDest + pos, c_str() + pos + str.length(), len - pos);
+		result.setLength(len);
 
-			xstrncpy(szBuf, c_str(), count);
-			szBuf[count] = 0;
-			xstrcat(szBuf, pos + strlen);
+		return(result);
+	}
 
-			return(result);
-		}
+	Derived operator-(const Derived &str) const
+	{
+		return(*this - View(str));
+	}
 
-		return(*(Derived*)this);
+	Derived operator-(const T *str) const
+	{
+		return(*this - View(str));
 	}
 
 	Derived operator-(T sym) const
 	{
-		return(*this - Derived(sym));
+		return(*this - View(&sym, 1));
 	}
 
 	Derived operator-(int num) const
@@ -644,45 +741,32 @@ public:
 
 	Derived operator-(bool bf) const
 	{
-		return(*this - Derived(num));
+		return(*this - Derived(bf));
+	}
+
+	Derived &operator-=(const View &str)
+	{
+		size_t pos = find(str);
+		if(pos != EOS)
+		{
+			remove(pos, str.length());
+		}
+		return(*(Derived*)this);
 	}
 
 	Derived &operator-=(const Derived &str)
 	{
-		return(*this -= str.c_str());
+		return(*this -= View(str));
 	}
 
 	Derived &operator-=(const T *str)
 	{
-		if(length() > 0)
-		{
-			size_t len = xstrlen(str);
-			T *szData = m_isStack ? m_data.stack.szStr : m_data.heap.szStr;
-			T *pos = xstrstr(szData, str);
-			size_t size = length() - (pos - szData) - len;
-
-			if(!pos)
-			{
-				return(*(Derived*)this);
-			}
-
-			if(m_isStack)
-			{
-				m_data.stack.size -= (byte)len;
-			}
-			else
-			{
-				m_data.heap.size -= len;
-			}
-
-			xmemmove(pos, pos + len, size + 1);
-		}
-		return(*(Derived*)this);
+		return(*this -= View(str));
 	}
 
 	Derived &operator-=(T sym)
 	{
-		return(*this -= Derived(sym));
+		return(*this -= View(&sym, 1));
 	}
 
 	Derived &operator-=(int num)
@@ -720,43 +804,27 @@ public:
 		return(*this -= Derived(bf));
 	}
 
+	//! строка без всех вхождений str, включая образовавшиеся после удаления
+	Derived operator/(const View &str) const
+	{
+		Derived result(*(const Derived*)this);
+		result /= str;
+		return(result);
+	}
+
 	Derived operator/(const Derived &str) const
 	{
-		return(*this / str.c_str());
+		return(*this / View(str));
 	}
 
 	Derived operator/(const T *str) const
 	{
-		size_t len = length();
-		Derived result;
-
-		if(len > 0)
-		{
-			T *szData = (T*)_malloca(sizeof(T) * (len + 1));
-			xstrcpy(szData, c_str());
-
-			T *pos = xstrstr(szData, str);
-			size_t delLen = xstrlen(str);
-			size_t size = 0;
-
-			while(pos)
-			{
-				size = len - (pos - szData) - delLen;
-				len = len - delLen;
-				xmemmove(pos, pos + delLen, size + 1);
-				pos = xstrstr(szData, str);
-			}
-
-			result = szData;
-			_freea(szData);
-		}
-
-		return(result);
+		return(*this / View(str));
 	}
 
 	Derived operator/(T sym) const
 	{
-		return(*this / Derived(sym));
+		return(*this / View(&sym, 1));
 	}
 
 	Derived operator/(int num) const
@@ -794,47 +862,48 @@ public:
 		return(*this / Derived(bf));
 	}
 
-	Derived &operator/=(const Derived &str)
+	Derived &operator/=(const View &str)
 	{
-		return(*this /= str.c_str());
-	}
+		if(!str.length())
+		{
+			return(*(Derived*)this);
+		}
+		if(isOwnData(str.data()))
+		{
+			Derived tmp(str);
+			return(*this /= View(tmp));
+		}
 
-	Derived &operator/=(const T *str)
-	{
+		T *szData = getData();
 		size_t len = length();
+		size_t delLen = str.length();
+		size_t pos = 0;
 
-		if(len > 0)
+		while((pos = View(szData, len).find(str, pos)) != EOS)
 		{
-			T *szData = m_isStack ? m_data.stack.szStr : m_data.heap.szStr;
-
-			T *pos = xstrstr(szData, str);
-			size_t delLen = xstrlen(str);
-			size_t size = 0;
-
-			while(len > 0 && pos)
-			{
-				size = len - (pos - szData) - delLen;
-				len = len - delLen;
-				xmemmove(pos, pos + delLen, size + 1);
-				pos = xstrstr(pos, str);
-			}
-
-			if(m_isStack)
-			{
-				m_data.stack.size = (byte)len;
-			}
-			else
-			{
-				m_data.heap.size = len;
-			}
+			xmemmove(szData + pos, szData + pos + delLen, len - pos - delLen);
+			len -= delLen;
+			// новое вхождение может начаться не раньше чем за delLen - 1 символов до места удаления
+			pos = pos >= delLen - 1 ? pos - (delLen - 1) : 0;
 		}
+		setLength(len);
 
 		return(*(Derived*)this);
 	}
 
-	Derived &operator/=(T sym)
+	Derived &operator/=(const Derived &str)
+	{
+		return(*this /= View(str));
+	}
+
+	Derived &operator/=(const T *str)
 	{
-		return(*this /= Derived(sym));
+		return(*this /= View(str));
+	}
+
+	Derived &operator/=(T sym)
+	{
+		return(*this /= View(&sym, 1));
 	}
 
 	Derived &operator/=(int num)
@@ -872,43 +941,24 @@ public:
 		return(*this /= Derived(bf));
 	}
 
-	bool operator==(const Derived &str) const
+	bool operator==(const View &str) const
 	{
-		if(this != &str)
-		{
-			if(length() == str.length())
-			{
-				return(xstrcmp(c_str(), str.c_str()) == 0);
-			}
-		}
-		else
-		{
-			return(true);
-		}
+		return(View(*this) == str);
+	}
 
-		return(false);
+	bool operator==(const Derived &str) const
+	{
+		return(this == &str || View(*this) == View(str));
 	}
 
 	bool operator==(const T *str) const
 	{
-		if(c_str() != str)
-		{
-			if(length() == xstrlen(str))
-			{
-				return(xstrcmp(c_str(), str) == 0);
-			}
-		}
-		else
-		{
-			return(true);
-		}
-
-		return(false);
+		return(c_str() == str || View(*this) == View(str));
 	}
 
 	bool operator==(T sym) const
 	{
-		return(*this == Derived(sym));
+		return(length() == 1 && c_str()[0] == sym);
 	}
 
 	bool operator==(int num) const
@@ -946,19 +996,24 @@ public:
 		return(*this == Derived(bf));
 	}
 
+	bool operator!=(const View &str) const
+	{
+		return(!(*this == str));
+	}
+
 	bool operator!=(const Derived &str) const
 	{
-		return(!(*this == Derived(str)));
+		return(!(*this == str));
 	}
 
 	bool operator!=(const T *str) const
 	{
-		return(!(*this == Derived(str)));
+		return(!(*this == str));
 	}
 
 	bool operator!=(T sym) const
 	{
-		return(!(*this == Derived(sym)));
+		return(!(*this == sym));
 	}
 
 	bool operator!=(int num) const
@@ -999,204 +1054,208 @@ public:
 	T& operator[](size_t index)
 	{
 		assert(index <= length());
-		return(m_isStack ? m_data.stack.szStr[index] : m_data.heap.szStr[index]);
+		return(getData()[index]);
 	}
 
 	const T& operator[](size_t index) const
 	{
 		assert(index <= length());
-		return(m_isStack ? m_data.stack.szStr[index] : m_data.heap.szStr[index]);
+		return(c_str()[index]);
 	}
 
 	size_t length() const
 	{
-		return(m_isStack ? m_data.stack.size : m_data.heap.size);
+		return(isStack() ? getStackChars() - m_data.aRaw[sizeof(m_data) - 1] : m_data.heap.size);
 	}
 
-	void insert(size_t pos, const T *data)
+	void insert(size_t pos, const View &data)
 	{
-		size_t dataLen = xstrlen(data);
-		size_t newLen = length() + dataLen;
-
-		T *szTmp = (T*)_malloca(sizeof(T) * (newLen + 1));
-	
-		xmemcpy(szTmp, c_str(), pos);
-		szTmp[pos] = 0;
-		xstrcat(szTmp, data);
-		xstrcat(szTmp, c_str() + pos);
+		assert(pos <= length());
+		if(isOwnData(data.data()))
+		{
+			Derived tmp(data);
+			insert(pos, View(tmp));
+			return;
+		}
 
-		*this = szTmp;
+		size_t len = length();
+		T *szData = reserveBuffer(len + data.length());
+		xmemmove(szData + pos + data.length(), szData + pos, len - pos);
+		if(data.length())
+		{
+			xmemcpy(szData + pos, data.data(), data.length());
+		}
+		setLength(len + data.length());
+	}
 
-		_freea(szTmp);
+	void insert(size_t pos, const T *data)
+	{
+		insert(pos, View(data));
 	}
 
 	void insert(size_t pos, const Derived &data)
 	{
-		insert(pos, data.c_str());
+		insert(pos, View(data));
 	}
 
 	size_t find(T c, size_t pos = 0) const
 	{
-		const T *chr = xstrchr(c_str() + pos, c);
+		return(View(*this).find(c, pos));
+	}
 
-		return(chr ? (size_t)(chr - c_str()) : EOS);
+	size_t find(const View &str, size_t pos = 0) const
+	{
+		return(View(*this).find(str, pos));
 	}
 
 	size_t find(const T *str, size_t pos = 0) const
 	{
-		const T *it = xstrstr(c_str() + pos, str);
-
-		return(it ? (size_t)(it - c_str()) : -1);
+		return(find(View(str), pos));
 	}
 
 	size_t find(const Derived& str, size_t pos = 0) const
 	{
-		return(find(str.c_str(), pos));
+		return(find(View(str), pos));
 	}
 
+	//! последнее вхождение c не раньше pos
 	size_t find_last_of(T c, size_t pos = 0) const
 	{
-		const T *it = c_str() + pos;
-		const T *res = NULL;
-
-		while((it = xstrchr(it, c)))
+		const T *str = c_str();
+		for(size_t i = length(); i > pos; --i)
 		{
-			res = it;
-			++it;
+			if(str[i - 1] == c)
+			{
+				return(i - 1);
+			}
 		}
 
-		return(res ? (size_t)(res - c_str()) : EOS);
+		return(EOS);
 	}
 
-	size_t find_last_of(const T *str, size_t pos = 0) const
+	//! последнее из непересекающихся вхождений str, найденных просмотром с pos
+	size_t find_last_of(const View &str, size_t pos = 0) const
 	{
-		const T *it = c_str() + pos;
-		const T *res = NULL;
+		if(!str.length())
+		{
+			return(EOS);
+		}
 
-		while((it = xstrstr(it, str)))
+		View self(*this);
+		size_t res = EOS;
+		while((pos = self.find(str, pos)) != EOS)
 		{
-			res = it;
-			it += xstrlen(str);
+			res = pos;
+			pos += str.length();
 		}
 
-		return(res ? (size_t)(res - c_str()) : EOS);
+		return(res);
+	}
+
+	size_t find_last_of(const T *str, size_t pos = 0) const
+	{
+		return(find_last_of(View(str), pos));
 	}
 
 	size_t find_last_of(const Derived &str, size_t pos = 0) const
 	{
-		return(find_last_of(str.c_str(), pos));
+		return(find_last_of(View(str), pos));
 	}
 
-	size_t replace(const T *str, const T *replace, size_t pos)
+	//! заменяет первое вхождение str не раньше pos, возвращает позицию замены или EOS
+	size_t replace(const View &str, const View &replace, size_t pos)
 	{
 		const size_t res = find(str, pos);
 
 		if(res != EOS)
 		{
-			size_t len = xstrlen(str);
-			size_t replaceLen = xstrlen(replace);
-			size_t newLen = length() - len + replaceLen;
-
-			const T *data = c_str();
-			T *buff = (T*)_malloca(sizeof(T) * (newLen + 1));
-
-			xstrncpy(buff, data, res);
-			buff[res] = 0;
-			xstrcat(buff, replace);
-			xstrcat(buff, data + res + len);
-
-			*this = buff;
-
-			_freea(buff);
-
-			return(res);
+			replaceRange(res, str.length(), replace);
 		}
 
-		return(EOS);
+		return(res);
+	}
+
+	size_t replace(const T *str, const T *replace, size_t pos)
+	{
+		return(StringBase::replace(View(str), View(replace), pos));
 	}
 
 	size_t replace(const Derived &str, const Derived &replace, size_t pos)
 	{
-		return(StringBase::replace(str.c_str(), replace.c_str(), pos));
+		return(StringBase::replace(View(str), View(replace), pos));
 	}
 
-	size_t replaceAll(const T *str, const T *replace)
+	//! заменяет все непересекающиеся вхождения str, возвращает количество замен
+	size_t replaceAll(const View &str, const View &replace)
 	{
-		size_t len = xstrlen(str);
-		size_t replaceLen = xstrlen(replace);
-		size_t result = 0;
-		size_t pos = 0;
-		const T *it = c_str();
+		if(!str.length())
+		{
+			return(0);
+		}
 
-		while((it = xstrstr(it, str)))
+		View self(*this);
+		size_t result = 0;
+		for(size_t pos = 0; (pos = self.find(str, pos)) != EOS; pos += str.length())
 		{
 			++result;
-			it += len;
 		}
 
 		if(result != 0)
 		{
-			if(len < replaceLen)
-			{
-				size_t size = result * (replaceLen - len);
-				size_t capacity = calcCapacity(size);
-				T *szStr = new T[capacity];
-				xstrcpy(szStr, c_str());
+			size_t newLen = length() - result * str.length() + result * replace.length();
+			Derived tmp;
+			T *szDest = tmp.reserveBuffer(newLen);
+			size_t from = 0;
+			size_t pos;
 
-				release();
-
-				m_isStack = false;
-				m_data.heap.capacity = capacity;
-				m_data.heap.size = size;
-				m_data.heap.szStr = szStr;
+			while((pos = self.find(str, from)) != EOS)
+			{
+				xmemcpy(szDest, c_str() + from, pos - from);
+				szDest += pos - from;
+				if(replace.length())
+				{
+					xmemcpy(szDest, replace.data(), replace.length());
+					szDest += replace.length();
+				}
+				from = pos + str.length();
 			}
-		}
+			xmemcpy(szDest, c_str() + from, length() - from);
+			tmp.setLength(newLen);
 
-		do{
-			pos = StringBase::replace(str, replace, pos);
+			std::swap(m_data, tmp.m_data);
 		}
-		while(pos != EOS);
 
 		return(result);
 	}
 
+	size_t replaceAll(const T *str, const T *replace)
+	{
+		return(replaceAll(View(str), View(replace)));
+	}
+
 	size_t replaceAll(const Derived &str, const Derived &replace)
 	{
-		return(replaceAll(str.c_str(), replace.c_str()));
+		return(replaceAll(View(str), View(replace)));
 	}
 
 	Derived substr(size_t pos, size_t len = EOS) const
 	{
-		if(pos >= length())
-		{
-			return(Derived());
-		}
-
-		if(len == 0)
-		{
-			return(Derived());
-		}
-
 		Derived result;
-		const T *it = c_str() + pos;
-
-		if(len == EOS || len > length() - pos)
+		View sub = view(pos, len);
+		if(sub.length())
 		{
-			len = length() - pos;
+			result.assign(sub.data(), sub.length());
 		}
 
-		T *str = (T*)_malloca(sizeof(T) * (len + 1));
-
-		xstrncpy(str, it, len);
-		str[len] = 0;
-
-		result = str;
-
-		_freea(str);
-
 		return(result);
 	}
 
+	//! подстрока без копирования, действительна до изменения строки
+	View view(size_t pos = 0, size_t len = EOS) const
+	{
+		return(View(*this).substr(pos, len));
+	}
+
 	size_t remove(size_t pos, size_t size)
 	{
 		size_t len = length();
@@ -1211,20 +1270,9 @@ public:
 			size = len - pos;
 		}
 
-		T *str = m_isStack ? m_data.stack.szStr : m_data.heap.szStr;
-		T *it = str + pos;
-		size_t count = len - (it - str) - size;
-
-		xmemmove(it, it + size, count + 1);
-
-		if(m_isStack)
-		{
-			m_data.stack.size -= size;
-		}
-		else
-		{
-			m_data.heap.size -= size;
-		}
+		T *str = getData();
+		xmemmove(str + pos, str + pos + size, len - pos - size);
+		setLength(len - size);
 
 		return(size);
 	}
@@ -1250,49 +1298,18 @@ public:
 
 	const T* c_str() const
 	{
-		return(m_isStack ? m_data.stack.szStr : m_data.heap.szStr);
+		return(isStack() ? m_data.stack.szStr : m_data.heap.szStr);
 	}
 
 	void resize(size_t len)
 	{
-		if(len > capacity())
-		{
-			appendReserve(len - length());
-		}
-
-		if(m_isStack)
-		{
-			m_data.stack.size = (byte)len;
-			m_data.stack.szStr[len] = 0;
-		}
-		else
-		{
-			m_data.heap.size = len;
-			m_data.heap.szStr[len] = 0;
-		}
+		reserveBuffer(len);
+		setLength(len);
 	}
 
 	void appendReserve(size_t len)
 	{
-		size_t newLen = len + length();
-		if((m_isStack && newLen > getStackSize()) ||
-			(!m_isStack && newLen > m_data.heap.capacity))
-		{
-			size_t size = length();
-			T *cpy = (T*)_malloca(sizeof(T) * (size + 1));
-			xstrcpy(cpy, c_str());
-
-			release();
-
-			m_isStack = false;
-			m_data.heap.capacity = calcCapacity(newLen);
-			m_data.heap.size = size;
-			m_data.heap.szStr = new T[capacity()];
-
-			xstrcpy(m_data.heap.szStr, cpy);
-
-			_freea(cpy);
-		}
+		reserveBuffer(length() + len);
 	}
 
 	int	toInt() const
@@ -1344,12 +1361,22 @@ public:
 
 	size_t capacity() const
 	{
-		return(m_isStack ? getStackSize() : m_data.heap.capacity);
+		return(isStack() ? getStackSize() : (m_data.heap.capacity & ~STRING_HEAP_FLAG));
+	}
+
+	bool operator<(const View &str) const
+	{
+		return(View(*this) < str);
 	}
 
 	bool operator<(const Derived &str) const
 	{
-		return(xstrcmp(c_str(), str.c_str()) < 0);
+		return(View(*this) < View(str));
+	}
+
+	bool operator<(const T *str) const
+	{
+		return(xstrcmp(c_str(), str) < 0);
 	}
 
 	static const size_t EOS = -1;
@@ -1358,52 +1385,187 @@ private:
 	template <typename Type>
 	void initFormat(const char *szFormat, Type arg)
 	{
-		size_t len = snprintf(NULL, 0, szFormat, arg);
-		T *szDest = NULL;
+		// любое число в этих форматах короче 64 символов
+		T szBuf[64];
+		int len = xsnprintf(szBuf, ARRAYSIZE(szBuf), szFormat, arg);
+
+		setStack();
+		assign(szBuf, len > 0 ? (size_t)len : 0);
+	}
+
+	static T* AllocBuffer(size_t uCapacity)
+	{
+		return((T*)Allocator::Alloc(sizeof(T) * uCapacity, alignof(T)));
+	}
+
+	bool isStack() const
+	{
+		return(!(m_data.aRaw[sizeof(m_data) - 1] & 0x80));
+	}
+
+	//! символов во внутреннем буфере, не считая последнего элемента, хранящего длину
+	static size_t getStackChars()
+	{
+		return(sizeof(m_data) / sizeof(T) - 1);
+	}
+
+	//! объем внутреннего буфера с завершающим нулем: у однобайтовых строк нулем служит байт длины
+	static size_t getStackSize()
+	{
+		return(sizeof(T) == 1 ? getStackChars() + 1 : getStackChars());
+	}
+
+	size_t calcCapacity(size_t len) const
+	{
+		return(len + (len % 2 ? (len - 1) / 2 : (len / 2)));
+	}
+
+	T* getData()
+	{
+		return(isStack() ? m_data.stack.szStr : m_data.heap.szStr);
+	}
+
+	bool isOwnData(const T *str) const
+	{
+		const T *szData = c_str();
+		return(str >= szData && str <= szData + length());
+	}
+
+	//! пустая строка внутри объекта, прежний буфер не освобождается
+	void setStack()
+	{
+		m_data.stack.szStr[0] = 0;
+		m_data.aRaw[sizeof(m_data) - 1] = (byte)getStackChars();
+	}
+
+	void freeHeap()
+	{
+		if(!isStack())
+		{
+			Allocator::Free(m_data.heap.szStr, sizeof(T) * capacity());
+		}
+	}
 
-		if(len + 1 <= getStackSize())
+	//! устанавливает длину и завершающий ноль, буфер должен вмещать len + 1 символов
+	void setLength(size_t len)
+	{
+		if(isStack())
 		{
-			szDest = m_data.stack.szStr;
-			m_data.stack.size = (byte)len;
+			if(len < getStackChars())
+			{
+				m_data.stack.szStr[len] = 0;
+			}
+			m_data.aRaw[sizeof(m_data) - 1] = (byte)(getStackChars() - len);
 		}
 		else
 		{
-			szDest = m_data.heap.szStr;
-			appendReserve(len + 1);
 			m_data.heap.size = len;
+			m_data.heap.szStr[len] = 0;
+		}
+	}
+
+	//! обеспечивает место под len символов и завершающий ноль, содержимое сохраняется
+	T* reserveBuffer(size_t len)
+	{
+		if(len + 1 <= capacity())
+		{
+			return(getData());
 		}
 
-		xsprintf(szDest, szFormat, arg);
+		size_t uLength = length();
+		size_t uCapacity = calcCapacity(len + 1);
+		T *szStr = AllocBuffer(uCapacity);
+		xmemcpy(szStr, c_str(), uLength);
+		freeHeap();
+
+		m_data.heap.szStr = szStr;
+		m_data.heap.capacity = uCapacity | STRING_HEAP_FLAG;
+		setLength(uLength);
+
+		return(szStr);
 	}
 
-	int getStackSize() const
+	//! str может указывать внутрь этой строки
+	void assign(const T *str, size_t len)
 	{
-		return(ARRAYSIZE(m_data.stack.szStr));
+		if(len + 1 <= capacity())
+		{
+			T *szData = getData();
+			if(len)
+			{
+				xmemmove(szData, str, len);
+			}
+			setLength(len);
+			return;
+		}
+
+		size_t uCapacity = calcCapacity(len + 1);
+		T *szStr = AllocBuffer(uCapacity);
+		xmemcpy(szStr, str, len);
+		freeHeap();
+
+		m_data.heap.szStr = szStr;
+		m_data.heap.capacity = uCapacity | STRING_HEAP_FLAG;
+		setLength(len);
 	}
 
-	size_t calcCapacity(size_t len) const
+	//! str может указывать внутрь этой строки
+	void append(const T *str, size_t len)
 	{
-		return(len + (len % 2 ? (len - 1) / 2 : (len / 2)));
+		size_t uLength = length();
+		if(uLength + len + 1 > capacity() && isOwnData(str))
+		{
+			size_t uOffset = str - c_str();
+			str = reserveBuffer(uLength + len) + uOffset;
+		}
+
+		T *szData = reserveBuffer(uLength + len);
+		if(len)
+		{
+			xmemmove(szData + uLength, str, len);
+		}
+		setLength(uLength + len);
+	}
+
+	//! заменяет len символов с позиции pos на replace
+	void replaceRange(size_t pos, size_t len, const View &replace)
+	{
+		if(isOwnData(replace.data()))
+		{
+			Derived tmp(replace);
+			replaceRange(pos, len, View(tmp));
+			return;
+		}
+
+		size_t uLength = length();
+		size_t newLen = uLength - len + replace.length();
+		T *szData = reserveBuffer(newLen);
+		xmemmove(szData + pos + replace.length(), szData + pos + len, uLength - pos - len);
+		if(replace.length())
+		{
+			xmemcpy(szData + pos, replace.data(), replace.length());
+		}
+		setLength(newLen);
 	}
 
 	union
 	{
-#pragma pack(push, 1)
 		struct Heap
 		{
-			size_t capacity;
-			size_t size;
 			T *szStr;
+			size_t size;
+			//! объем буфера, старший байт содержит STRING_HEAP_FLAG
+			size_t capacity;
 		} heap;
 
 		struct
 		{
-			T szStr[(sizeof(Heap) - 1) / sizeof(T)];
-			byte size;
-		}stack;
-#pragma pack(pop)
+			//! последний элемент хранит в последнем байте getStackChars() - length()
+			T szStr[sizeof(Heap) / sizeof(T)];
+		} stack;
+
+		byte aRaw[sizeof(Heap)];
 	} m_data;
-	bool m_isStack = true;
 };
 
 class String: public StringBase<char, String>
@@ -1428,6 +1590,16 @@ public:
 	{
 	}
 
+	String(const char *str, size_t len):
+		StringBase(str, len)
+	{
+	}
+
+	explicit String(const StringView &str):
+		StringBase(str)
+	{
+	}
+
 	String(char sym):
 		StringBase(sym)
 	{
@@ -1473,6 +1645,11 @@ public:
 	{
 	}
 
+	String(String &&str):
+		StringBase(std::move(str))
+	{
+	}
+
 	String& operator=(const String &str)
 	{
 		return(StringBase::operator=(str));
@@ -1503,11 +1680,26 @@ public:
 	{
 	}
 
+	StringW(StringW &&str):
+		StringBase(std::move(str))
+	{
+	}
+
 	StringW(const wchar_t *str):
 		StringBase(str)
 	{
 	}
 
+	StringW(const wchar_t *str, size_t len):
+		StringBase(str, len)
+	{
+	}
+
+	explicit StringW(const StringViewW &str):
+		StringBase(str)
+	{
+	}
+
 	StringW(wchar_t sym):
 		StringBase(sym)
 	{
@@ -1562,13 +1754,17 @@ inline String::operator StringW() const
 	StringW result;
 	size_t len = length() + 1;
 
-	result.resize(len);
-
 #if defined(_WIN32)
+	result.resize(len);
 	MultiByteToWideChar(CP_UTF8, 0, c_str(), (int)len, &result[0], (int)len);
 #else
-	TODO("CHECK THIS");
-	mbstowcs(&result[0], c_str(), len);
+	len = mbstowcs(NULL, c_str(), 0);
+	if(len == (size_t)-1)
+	{
+		return(StringW());
+	}
+	result.resize(len);
+	mbstowcs(&result[0], c_str(), len + 1);
 #endif
 
 	return(result);
@@ -1583,15 +1779,165 @@ inline StringW::operator String() const
 	result.resize(size);
 	WideCharToMultiByte(CP_UTF8, 0, c_str(), (int)(length() + 1), &result[0], (int)size, NULL, NULL);
 #else
-	TODO("CHECK THIS");
-	size_t len = length() + 1;
-	result.resize(size);
-	mbstowcs(&result[0], c_str(), len);
+	size_t len = wcstombs(NULL, c_str(), 0);
+	if(len == (size_t)-1)
+	{
+		return(String());
+	}
+	result.resize(len);
+	wcstombs(&result[0], c_str(), len + 1);
 #endif
 
 	return(result);
 }
 
+/*! Строка, хранящая длинные значения в текущей арене потока (см. MemArenaScope).
+	Должна быть уничтожена до отката арены
+*/
+class ArenaString: public StringBase<char, ArenaString, ArenaAllocator>
+{
+public:
+
+	using StringBase::operator=;
+	using StringBase::operator+;
+	using StringBase::operator+=;
+	using StringBase::operator-=;
+	using StringBase::operator-;
+	using StringBase::operator/;
+	using StringBase::operator/=;
+
+	ArenaString():
+		StringBase()
+	{
+	}
+
+	ArenaString(const char *str):
+		StringBase(str)
+	{
+	}
+
+	ArenaString(const char *str, size_t len):
+		StringBase(str, len)
+	{
+	}
+
+	explicit ArenaString(const StringView &str):
+		StringBase(str)
+	{
+	}
+
+	ArenaString(const String &str):
+		StringBase(StringView(str))
+	{
+	}
+
+	ArenaString(char sym):
+		StringBase(sym)
+	{
+	}
+
+	ArenaString(int num):
+		StringBase(num)
+	{
+	}
+
+	ArenaString(UINT num):
+		StringBase(num)
+	{
+	}
+
+	ArenaString(const ArenaString &str):
+		StringBase(str)
+	{
+	}
+
+	ArenaString(ArenaString &&str):
+		StringBase(std::move(str))
+	{
+	}
+
+	ArenaString& operator=(const ArenaString &str)
+	{
+		return(StringBase::operator=(str));
+	}
+};
+
+static_assert(sizeof(String) == sizeof(void*) * 3, "String must fit into three machine words");
+
+//! строки не хранят указателей на себя и переносятся в Array побайтово
+template<>
+struct ArrayIsRelocatable<String>: std::true_type
+{
+};
+
+template<>
+struct ArrayIsRelocatable<StringW>: std::true_type
+{
+};
+
+template<>
+struct ArrayIsRelocatable<ArenaString>: std::true_type
+{
+};
+
+//! строковые ключи AssotiativeArray ищутся по указателю на символы и View без создания строки
+#define STRING_TRANSPARENT_KEY(K, T) \
+	template<> struct XIsTransparentKey<K, const T*>: std::true_type {}; \
+	template<> struct XIsTransparentKey<K, T*>: std::true_type {}; \
+	template<> struct XIsTransparentKey<K, StringViewBase<T>>: std::true_type {};
+
+STRING_TRANSPARENT_KEY(String, char)
+STRING_TRANSPARENT_KEY(StringW, wchar_t)
+STRING_TRANSPARENT_KEY(ArenaString, char)
+
+#undef STRING_TRANSPARENT_KEY
+
+//! хеш строк для HashMap, считается по содержимому
+template<>
+struct XHash<String>
+{
+	size_t operator()(const String &str) const
+	{
+		return((size_t)XHashBytes(str.c_str(), str.length() * sizeof(char)));
+	}
+};
+
+template<>
+struct XHash<StringW>
+{
+	size_t operator()(const StringW &str) const
+	{
+		return((size_t)XHashBytes(str.c_str(), str.length() * sizeof(wchar_t)));
+	}
+};
+
+template<>
+struct XHash<ArenaString>
+{
+	size_t operator()(const ArenaString &str) const
+	{
+		return((size_t)XHashBytes(str.c_str(), str.length() * sizeof(char)));
+	}
+};
+
+template<>
+struct XHash<StringView>
+{
+	size_t operator()(const StringView &str) const
+	{
+		return((size_t)XHashBytes(str.data(), str.length() * sizeof(char)));
+	}
+};
+
+template<>
+struct XHash<StringViewW>
+{
+	size_t operator()(const StringViewW &str) const
+	{
+		return((size_t)XHashBytes(str.data(), str.length() * sizeof(wchar_t)));
+	}
+};
+
 #pragma warning(pop)
 
 #endif
@@ -6,36 +6,44 @@ See the license in LICENSE
 
 #include "string_utils.h"
 
-Array<String> StrExplode(const char *szStr, const char *szDelimiter, bool isAllowEmpty, int iCount)
+Array<StringView> StrExplodeView(const StringView &sStr, const StringView &sDelimiter, bool isAllowEmpty, int iCount)
 {
-	Array<String> aStrings;
-	size_t iBeginPos = 0, iLen = 0;
-	const char *szFound = 0;
+	Array<StringView> aStrings;
+	size_t uPos = 0, uFound = 0;
 
-	while (szStr && (iCount <= 0 || (iCount-1) > (int)aStrings.size()))
+	while(sDelimiter.length() && (iCount <= 0 || (iCount - 1) > (int)aStrings.size()))
 	{
-		if((szFound = strstr(szStr, szDelimiter)) == 0)
+		if((uFound = sStr.find(sDelimiter, uPos)) == StringView::EOS)
 			break;
 
-		iLen = szFound - szStr;
-		//int iLen = (iLastPos - iBeginPos);
-		if(isAllowEmpty || (!isAllowEmpty && iLen > 0))
+		if(isAllowEmpty || uFound > uPos)
 		{
-			char *szNewStr = new char[iLen + 1];
-			memcpy(szNewStr, szStr, sizeof(char)* iLen);
-			szNewStr[iLen] = 0;
-			aStrings.push_back(szNewStr);
-			mem_delete_a(szNewStr);
+			aStrings.push_back(sStr.substr(uPos, uFound - uPos));
 		}
 
-		iBeginPos += iLen + strlen(szDelimiter);
-		szStr += iLen + strlen(szDelimiter);
+		uPos = uFound + sDelimiter.length();
+	}
+
+	if(uPos == 0 || isAllowEmpty || uPos < sStr.length())
+	{
+		aStrings.push_back(sStr.substr(uPos));
 	}
 
-	if(iBeginPos == 0 || (szStr && (isAllowEmpty || (!isAllowEmpty && strlen(szStr) > 0))))
-		aStrings.push_back(szStr);
+	return(aStrings);
+}
+
+Array<String> StrExplode(const StringView &sStr, const StringView &sDelimiter, bool isAllowEmpty, int iCount)
+{
+	Array<StringView> aViews = StrExplodeView(sStr, sDelimiter, isAllowEmpty, iCount);
+	Array<String> aStrings;
+	aStrings.reserve(aViews.size());
+
+	for(UINT i = 0, l = aViews.size(); i < l; ++i)
+	{
+		aStrings.push_back(String(aViews[i]));
+	}
 
-	return aStrings;
+	return(aStrings);
 }
 
 String StrWeld(const char *szDelimiter, const char *szStr1, ...)
@@ -64,249 +72,219 @@ String StrWeld(const char *szDelimiter, const char *szStr1, ...)
 
 //##########################################################################
 
-String StrTrim(const char *szStr, const char *szSyms)
+static bool StrHasSym(const StringView &sSyms, char c)
 {
-	int iStrLen = strlen(szStr);
-	int iSymsLen = strlen(szSyms);
-
-	if(!szStr && iStrLen <= 0)
-		return "";
-
-	int iStart = 0, iEnd = iStrLen, iCountFail = 0;
+	return(sSyms.find(c) != StringView::EOS);
+}
 
-	for(int i = 0, il = iStrLen; i < il; ++i)
-	{
-		iCountFail = 0;
+String StrTrim(const StringView &sStr, const StringView &sSyms)
+{
+	size_t uStart = 0, uEnd = sStr.length();
 
-		for(int k = 0, kl = iSymsLen; k < kl; ++k)
-		{
-			if(szStr[i] == szSyms[k])
-			{
-				++iStart;
-				break;
-			}
-			else
-				++iCountFail;
-		}
+	while(uStart < uEnd && StrHasSym(sSyms, sStr[uStart]))
+		++uStart;
 
-		if(iCountFail >= iSymsLen)
-			break;
-	}
+	while(uEnd > uStart && StrHasSym(sSyms, sStr[uEnd - 1]))
+		--uEnd;
 
-	for(int i = iStrLen - 1; i >= 0; ++i)
-	{
-		iCountFail = 0;
+	return(String(sStr.substr(uStart, uEnd - uStart)));
+}
 
-		for(int k = 0, kl = iSymsLen; k < kl; ++k)
-		{
-			if(szStr[i] == szSyms[k])
-			{
-				--iEnd;
-				break;
-			}
-			else
-				++iCountFail;
-		}
+String StrTrimL(const StringView &sStr, const StringView &sSyms)
+{
+	size_t uStart = 0;
 
-		if(iCountFail >= iSymsLen)
-			break;
-	}
+	while(uStart < sStr.length() && StrHasSym(sSyms, sStr[uStart]))
+		++uStart;
 
-	String sNewStr = szStr;
-	return(sNewStr.substr(iStart, iEnd - iStart));
+	return(String(sStr.substr(uStart)));
 }
 
-String StrTrimL(const char *szStr, const char *szSyms)
+String StrTrimR(const StringView &sStr, const StringView &sSyms)
 {
-	int iStrLen = strlen(szStr);
-	int iSymsLen = strlen(szSyms);
+	size_t uEnd = sStr.length();
 
-	if(!szStr && iStrLen <= 0)
-		return "";
+	while(uEnd > 0 && StrHasSym(sSyms, sStr[uEnd - 1]))
+		--uEnd;
 
-	int iStart = 0, iEnd = iStrLen, iCountFail = 0;
+	return(String(sStr.substr(0, uEnd)));
+}
 
-	for(int i = 0, il = iStrLen; i < il; ++i)
-	{
-		iCountFail = 0;
+//##########################################################################
 
-		for(int k = 0, kl = iSymsLen; k < kl; ++k)
-		{
-			if(szStr[i] == szSyms[k])
-			{
-				++iStart;
-				break;
-			}
-			else
-				++iCountFail;
-		}
+String StrInverse(const StringView &sStr)
+{
+	String sNewStr(sStr);
 
-		if(iCountFail >= iSymsLen)
-			break;
+	for(size_t i = 0, il = sStr.length(); i < il; ++i)
+	{
+		sNewStr[i] = sStr[(il - 1) - i];
 	}
 
-	String sNewStr = szStr;
-	return sNewStr.substr(iStart, iEnd - iStart);
+	return(sNewStr);
 }
 
-String StrTrimR(const char *szStr, const char *szSyms)
+//! сравнение участков без учета регистра
+static bool StrEqualI(const char *szLeft, const char *szRight, size_t uLen)
 {
-	int iStrLen = strlen(szStr);
-	int iSymsLen = strlen(szSyms);
+	for(size_t i = 0; i < uLen; ++i)
+	{
+		if(tolower((unsigned char)szLeft[i]) != tolower((unsigned char)szRight[i]))
+			return(false);
+	}
 
-	if(!szStr && strlen(szStr) <= 0)
-		return "";
+	return(true);
+}
 
-	int iStart = 0, iEnd = iStrLen, iCountFail = 0;
+static int StrFindImpl(const StringView &sStr, const StringView &sFinder, int iPos, bool isCaseInsensitive)
+{
+	if(iPos < 0 || (size_t)iPos > sStr.length() || sFinder.length() > sStr.length() - iPos)
+		return(-1);
 
-	for(int i = iStrLen - 1; i >= 0; ++i)
+	if(!isCaseInsensitive)
 	{
-		iCountFail = 0;
-
-		for(int k = 0, kl = iSymsLen; k < kl; ++k)
-		{
-			if(szStr[i] == szSyms[k])
-			{
-				--iEnd;
-				break;
-			}
-			else
-				++iCountFail;
-		}
+		size_t uFound = sStr.find(sFinder, iPos);
+		return(uFound == StringView::EOS ? -1 : (int)uFound);
+	}
 
-		if(iCountFail >= iSymsLen)
-			break;
+	for(size_t i = iPos, il = sStr.length() - sFinder.length(); i <= il; ++i)
+	{
+		if(StrEqualI(sStr.data() + i, sFinder.data(), sFinder.length()))
+			return((int)i);
 	}
 
-	String sNewStr = szStr;
-	return sNewStr.substr(iStart, iEnd - iStart);
+	return(-1);
 }
 
-//##########################################################################
-
-String StrInverse(const char *szStr)
+static int StrFindLastImpl(const StringView &sStr, const StringView &sFinder, int iPos, bool isCaseInsensitive)
 {
-	String sStr = szStr;
+	if(iPos < 0 || (size_t)iPos > sStr.length() || sFinder.length() > sStr.length() - iPos)
+		return(-1);
 
-	for (int i = 0, il = strlen(szStr); i < il; ++i)
+	// вхождение должно закончиться не дальше iPos символов от конца строки
+	for(size_t i = sStr.length() - iPos - sFinder.length() + 1; i > 0; --i)
 	{
-		sStr[i] = szStr[(il - 1) - i];
+		const char *szAt = sStr.data() + i - 1;
+		if(isCaseInsensitive ? StrEqualI(szAt, sFinder.data(), sFinder.length()) : !xmemcmp(szAt, sFinder.data(), sFinder.length()))
+			return((int)(i - 1 + sFinder.length()));
 	}
 
-	return sStr;
+	return(-1);
 }
 
-int StrFind(const char *szStr, const char *szFinder, int iPos)
+static int StrSubstrCountImpl(const StringView &sStr, const StringView &sFinder, bool isCaseInsensitive)
 {
-	const char *szStrFound = strstr(szStr + iPos, szFinder);
-	if (szStrFound)
+	if(!sFinder.length())
+		return(0);
+
+	int iCount = 0;
+	int iPos = 0;
+
+	while((iPos = StrFindImpl(sStr, sFinder, iPos, isCaseInsensitive)) >= 0)
 	{
-		return (szStrFound - szStr);
+		++iCount;
+		iPos += (int)sFinder.length();
 	}
-	return -1;
+
+	return(iCount);
 }
 
-int StrFindLast(const char *szStr, const char *szFinder, int iPos)
+int StrFind(const StringView &sStr, const StringView &sFinder, int iPos)
 {
-	String sStrInv = StrInverse(szStr);
-	String sFinderInv = StrInverse(szFinder);
+	return(StrFindImpl(sStr, sFinder, iPos, false));
+}
 
-	int iFoundPos = StrFind(sStrInv.c_str(), sFinderInv.c_str(), iPos);
-	if (iFoundPos > -1)
-		iFoundPos = strlen(szStr) - iFoundPos;
+int StrFindLast(const StringView &sStr, const StringView &sFinder, int iPos)
+{
+	return(StrFindLastImpl(sStr, sFinder, iPos, false));
+}
 
-	return iFoundPos;
+int StrFindI(const StringView &sStr, const StringView &sFinder, int iPos)
+{
+	return(StrFindImpl(sStr, sFinder, iPos, true));
 }
 
-int StrFindI(const char *szStr, const char *szFinder, int iPos)
+int StrFindILast(const StringView &sStr, const StringView &sFinder, int iPos)
 {
-	return StrFind(StrToLower(szStr).c_str(), StrToLower(szFinder).c_str(), iPos);
+	return(StrFindLastImpl(sStr, sFinder, iPos, true));
 }
 
-int StrFindILast(const char *szStr, const char *szFinder, int iPos)
+String StrSubstr(const StringView &sStr, int iStart, int iLen)
 {
-	return StrFindLast(StrToLower(szStr).c_str(), StrToLower(szFinder).c_str(), iPos);
+	return(String(sStr.substr(iStart, iLen > 0 ? iLen : StringView::EOS)));
 }
 
-String StrSubstr(const char *szStr, int iStart, int iLen)
+String StrSubstrSpre(const StringView &sStr, const StringView &sFinder, int iPos)
 {
-	const char *szStrBias = szStr + iStart;
+	int iFoundPos = StrFind(sStr, sFinder, iPos);
 
-	if (!iLen || iLen > strlen(szStrBias))
-		iLen = strlen(szStrBias);
+	if(iFoundPos > -1)
+		return(String(sStr.substr(iPos, iFoundPos - iPos)));
 
-	char *szStrNew = new char[iLen + 1];
-	memcpy(szStrNew, szStrBias, iLen);
-	szStrNew[iLen] = 0;
-	String sStr = szStrNew;
-	mem_delete_a(szStrNew);
-	return(sStr);
+	return(String());
 }
 
-String StrSubstrSpre(const char *szStr, const char *szFinder, int iPos)
+String StrSubstrSpost(const StringView &sStr, const StringView &sFinder, int iPos)
 {
-	int iFoundPos = StrFind(szStr, szFinder, iPos);
-	String sStr = "";
+	int iFoundPos = StrFind(sStr, sFinder, iPos);
 
-	if (iFoundPos > -1)
-		sStr = StrSubstr(szStr, iPos, iFoundPos - iPos);
+	if(iFoundPos > -1)
+		return(String(sStr.substr(iFoundPos + sFinder.length())));
 
-	return sStr;
+	return(String());
 }
 
-String StrSubstrSpost(const char *szStr, const char *szFinder, int iPos)
+int StrSubstrCount(const StringView &sStr, const StringView &sFinder)
 {
-	int iFoundPos = StrFind(szStr, szFinder, iPos);
-	String sStr = "";
-
-	if (iFoundPos > -1)
-		sStr = StrSubstr(szStr, iFoundPos + strlen(szFinder));
+	return(StrSubstrCountImpl(sStr, sFinder, false));
+}
 
-	return sStr;
+int StrSubstrICount(const StringView &sStr, const StringView &sFinder)
+{
+	return(StrSubstrCountImpl(sStr, sFinder, true));
 }
 
 //##########################################################################
 
-String StrToLower(const char *szStr)
+String StrToLower(const StringView &sStr)
 {
-	String sNewStr = szStr;
-	for(int i = 0, il = strlen(szStr); i < il; ++i)
+	String sNewStr(sStr);
+	for(size_t i = 0, il = sStr.length(); i < il; ++i)
 	{
 		sNewStr[i] = tolower((unsigned char)sNewStr[i]);
 	}
 
-	return sNewStr;
+	return(sNewStr);
 }
 
-String StrToUpper(const char *szStr)
+String StrToUpper(const StringView &sStr)
 {
-	String sNewStr = szStr;
-	for(int i = 0, il = strlen(szStr); i < il; ++i)
+	String sNewStr(sStr);
+	for(size_t i = 0, il = sStr.length(); i < il; ++i)
 	{
 		sNewStr[i] = toupper((unsigned char)sNewStr[i]);
 	}
 
-	return sNewStr;
+	return(sNewStr);
 }
 
 
-const char* StrCutStr(const char *szStr, const char *szFinder)
+const char* StrCutStr(const StringView &sStr, const StringView &sFinder)
 {
-	int iPos = StrFind(szStr, szFinder, 0);
-	if (iPos >= 0)
-		return szStr + iPos;
+	int iPos = StrFind(sStr, sFinder, 0);
+	if(iPos >= 0)
+		return(sStr.data() + iPos);
 
-	return 0;
+	return(0);
 }
 
-String StrCutStrI(const char *szStr, const char *szFinder)
+String StrCutStrI(const StringView &sStr, const StringView &sFinder)
 {
-	String sStr = "";
-	int iPos = StrFindI(szStr, szFinder, 0);
-	if (iPos >= 0)
-		sStr = (iPos == 0 ? String("") : StrSubstr(szStr, 0, iPos)) + StrSubstr(szStr, iPos + strlen(szFinder));
+	int iPos = StrFindI(sStr, sFinder, 0);
+	if(iPos >= 0)
+		return(String(sStr.substr(0, iPos)) + sStr.substr(iPos + sFinder.length()));
 
-	return sStr;
+	return(String());
 }
 
 
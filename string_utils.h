@@ -12,77 +12,80 @@ See the license in LICENSE
 #include <stdarg.h>
 #include <iostream>
 
-//! разделяет строку szStr на подстроки на основании разделителя szDelimiter
-Array<String> StrExplode(const char *szStr, const char *szDelimiter, bool isAllowEmpty = true, int iCount=0);
+//! разделяет строку sStr на подстроки на основании разделителя sDelimiter
+Array<String> StrExplode(const StringView &sStr, const StringView &sDelimiter, bool isAllowEmpty = true, int iCount=0);
+
+//! разделяет строку sStr как StrExplode, подстроки указывают в sStr и не копируются
+Array<StringView> StrExplodeView(const StringView &sStr, const StringView &sDelimiter, bool isAllowEmpty = true, int iCount=0);
 
 //! соединение всех строк, между строками вставить szDelimiter
 String StrWeld(const char *szDelimiter, const char *szStr1, ...);
 
 
-//! удаляет в строке szStr (пробельные) символы указанные в szSyms
-String StrTrim(const char *szStr, const char *szSyms = " \t\n\r");
+//! удаляет в строке sStr (пробельные) символы указанные в sSyms
+String StrTrim(const StringView &sStr, const StringView &sSyms = " \t\n\r");
 
-//! удаляет в начале строки szStr (пробельные) символы указанные в szSyms
-String StrTrimL(const char *szStr, const char *szSyms = " \t\n\r");
+//! удаляет в начале строки sStr (пробельные) символы указанные в sSyms
+String StrTrimL(const StringView &sStr, const StringView &sSyms = " \t\n\r");
 
-//! удаляем в конце строки szStr (пробельные) символы указанные в szSyms
-String StrTrimR(const char *szStr, const char *szSyms = " \t\n\r");
+//! удаляем в конце строки sStr (пробельные) символы указанные в sSyms
+String StrTrimR(const StringView &sStr, const StringView &sSyms = " \t\n\r");
 
 //##########################################################################
 
 //! инвертирование строки
-String StrInverse(const char *szStr);
+String StrInverse(const StringView &sStr);
 
-//! поиск в szStr подстроки szFinder с позиции iPos
-int StrFind(const char *szStr, const char *szFinder, int iPos = 0);
+//! поиск в sStr подстроки sFinder с позиции iPos
+int StrFind(const StringView &sStr, const StringView &sFinder, int iPos = 0);
 
-//! поиск последнего вхождения строки szFinder в szStr, iPos - позиция с конца
-int StrFindLast(const char *szStr, const char *szFinder, int iPos = 0);
+//! поиск последнего вхождения строки sFinder в sStr, iPos - позиция с конца, возвращает позицию конца вхождения
+int StrFindLast(const StringView &sStr, const StringView &sFinder, int iPos = 0);
 
-//! поиск в szStr подстроки szFinder с позиции iPos, без учета регистра
-int StrFindI(const char *szStr, const char *szFinder, int iPos = 0);
+//! поиск в sStr подстроки sFinder с позиции iPos, без учета регистра
+int StrFindI(const StringView &sStr, const StringView &sFinder, int iPos = 0);
 
-//! поиск последнего вхождения строки szFinder в szStr, без учета регистра, iPos - позиция с конца
-int StrFindILast(const char *szStr, const char *szFinder, int iPos = 0);
+//! поиск последнего вхождения строки sFinder в sStr, без учета регистра, iPos - позиция с конца, возвращает позицию конца вхождения
+int StrFindILast(const StringView &sStr, const StringView &sFinder, int iPos = 0);
 
 
-//! вырезает из строки szStr подстроку начиная с iStart и размером iLen, если iLen == 0 вырезает до конца строки
-String StrSubstr(const char *szStr, int iStart, int iLen=0);
+//! вырезает из строки sStr подстроку начиная с iStart и размером iLen, если iLen == 0 вырезает до конца строки
+String StrSubstr(const StringView &sStr, int iStart, int iLen=0);
 
 
 
-//! возвращает строку до вхождения szFinder в szStr
-String StrSubstrSpre(const char *szStr, const char *szFinder, int iPos = 0);
+//! возвращает строку до вхождения sFinder в sStr
+String StrSubstrSpre(const StringView &sStr, const StringView &sFinder, int iPos = 0);
 
-inline String StrSubstrS(const char *szStr, const char *szFinder, int iPos = 0)
+inline String StrSubstrS(const StringView &sStr, const StringView &sFinder, int iPos = 0)
 {
-	return StrSubstrSpre(szStr, szFinder, iPos);
+	return StrSubstrSpre(sStr, sFinder, iPos);
 }
 
-//! возвращает строку до вхождения szFinder в szStr
-String StrSubstrSpost(const char *szStr, const char *szFinder, int iPos = 0);
+//! возвращает строку после вхождения sFinder в sStr
+String StrSubstrSpost(const StringView &sStr, const StringView &sFinder, int iPos = 0);
 
-//! возвращает количество вхождений строки szFinder в строку szStr
-int StrSubstrCount(const char *szStr, const char *szFinder);
+//! возвращает количество вхождений строки sFinder в строку sStr
+int StrSubstrCount(const StringView &sStr, const StringView &sFinder);
 
-//! возвращает количество вхождений строки szFinder в строку szStr, без учета регистра
-int StrSubstrICount(const char *szStr, const char *szFinder);
+//! возвращает количество вхождений строки sFinder в строку sStr, без учета регистра
+int StrSubstrICount(const StringView &sStr, const StringView &sFinder);
 
 //##########################################################################
 
 //! преобразует строку в нижний регистр
-String StrToLower(const char *szStr);
+String StrToLower(const StringView &sStr);
 
 //! преобразует строку в верхний регистр
-String StrToUpper(const char *szStr);
+String StrToUpper(const StringView &sStr);
 
 //##########################################################################
 
-//! вырезает из строки szStr подстроку szFinder, единожды
-const char* StrCutStr(const char *szStr, const char *szFinder);
+//! возвращает указатель на первое вхождение sFinder в sStr или 0
+const char* StrCutStr(const StringView &sStr, const StringView &sFinder);
 
-//! вырезает из строки szStr подстроку szFinder, единожды, поиск подстроки без учета регистра
-String StrCutStrI(const char *szStr, const char *szFinder);
+//! вырезает из строки sStr подстроку sFinder, единожды, поиск подстроки без учета регистра
+String StrCutStrI(const StringView &sStr, const StringView &sFinder);
 
 
 #define STR_VALIDATE(str) ((str) && (str)[0]!=0 && (str)[0]!='0')